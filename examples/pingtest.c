@@ -9,229 +9,81 @@
 /**
  * Example RF Radio Ping Pair
  *
- * This is an example of how to use the RF24 class.  Write this sketch to two different nodes,
- * connect the role_pin to ground on one.  The ping node sends the current time to the pong node,
- * which responds by sending the value back.  The ping node can then see how long the whole cycle
- * took.
+ * Run with no arguments on one node and with "pong" on the other.  The ping
+ * node sends the current time to the pong node, which sends the value back.
+ * The ping node can then see how long the whole cycle took.
  */
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "compatibility.h"
+#include "rf24.h"
 
-#include "RF24.h"
+/* Radio addresses for the 2 nodes to communicate */
+uint8_t addresses[2][5] = {
+    {0xF0, 0xF0, 0xF0, 0xF0, 0xE1},
+    {0xF0, 0xF0, 0xF0, 0xF0, 0xD2}
+};
 
-//
-// Hardware configuration
-//
-
-// Set up nRF24L01 radio on SPI bus plus pins 9 & 10
-
-//RF24 radio(9,10);
-
-
-// sets the role of this unit in hardware.  Connect to GND to be the 'pong' receiver
-// Leave open to be the 'ping' transmitter
-const int role_pin = 7;
-
-//
-// Topology
-//
-
-// Radio pipe addresses for the 2 nodes to communicate.
-const uint64_t pipes[2] = { 0xF0F0F0F0E1LL, 0xF0F0F0F0D2LL };
-
-//
-// Role management
-//
-// Set up role.  This sketch uses the same software for all the nodes
-// in this system.  Doing so greatly simplifies testing.  The hardware itself specifies
-// which node it is.
-//
-// This is done through the role_pin
-//
-
-// The various roles supported by this sketch
 typedef enum { role_ping_out = 1, role_pong_back } role_e;
 
-// The debug-friendly names of those roles
-const char* role_friendly_name[] = { "invalid", "Ping out", "Pong back"};
+const char *role_friendly_name[] = {"invalid", "Ping out", "Pong back"};
 
-// The role of the current running sketch
 role_e role;
-
-void setup(void)
-{
-  //
-  // Role
-  //
-
-  // set up the role pin
- // pinMode(role_pin, INPUT);
-  //digitalWrite(role_pin,HIGH);
- // delay(20); // Just to get a solid reading on the role pin
-
-  // read the address pin, establish our role
-  //if ( ! digitalRead(role_pin) )
-    role = role_ping_out;
-  //else
-  //  role = role_pong_back;
-
-  //
-  // Print preamble:
-  //
-
-  //Serial.begin(115200);
-  //printf_begin();
-  printf("\n\rRF24/examples/pingpair/\n\r");
-  printf("ROLE: %s\n\r",role_friendly_name[role]);
-
-  //
-  // Setup and configure rf radio
-  //
-  rf24_init_radio("/dev/spidev0.0", 8000000, 25);  //spi device, speed and CSN,only CSN is NEEDED in RPI
-
-  // optionally, increase the delay between retries & # of retries
-  rf24_setRetries(15,15);
-
-  // optionally, reduce the payload size.  seems to
-  // improve reliability
-//  radio.setPayloadSize(8);
-  rf24_setChannel(0x4c);
-  rf24_setPALevel(RF24_PA_MAX);
-
-  //
-  // Open pipes to other nodes for communication
-  //
-
-  // This simple sketch opens two pipes for these two nodes to communicate
-  // back and forth.
-  // Open 'our' pipe for writing
-  // Open the 'other' pipe for reading, in position #1 (we can have up to 5 pipes open for reading)
-
-  if ( role == role_ping_out )
-  {
-    rf24_openWritingPipe(pipes[0]);
-    rf24_openReadingPipe(1,pipes[1]);
-  }
-  else
-  {
-    rf24_openWritingPipe(pipes[1]);
-    rf24_openReadingPipe(1,pipes[0]);
-  }
-
-  //
-  // Start listening
-  //
-
-  rf24_startListening();
-
-  //
-  // Dump the configuration of the rf unit for debugging
-  //
-
-  rf24_printDetails();
+RF24Ctx *radio;
+
+void setup(void) {
+    printf("\nRF24/examples/pingpair/\n");
+    printf("ROLE: %s\n", role_friendly_name[role]);
+
+    radio = rf24_init_radio("/dev/spidev0.0", 8000000, 25);
+    if (radio == NULL) exit(-1);
+    /* Optionally, increase the delay between retries & # of retries */
+    rf24_setRetries(radio, 15, 15);
+    rf24_setChannel(radio, 0x4c);
+    rf24_setPALevel(radio, RF24_PA_MAX);
+    rf24_enableDynamicPayloads(radio);
+
+    /* Listen on our own address, replies go back to the sender's */
+    rf24_setRXAddressOnPipe(radio, addresses[role == role_ping_out ? 0 : 1], 1);
+    rf24_startListening(radio);
+    rf24_printDetails(radio);
 }
 
-void loop(void)
-{
-  //
-  // Ping out role.  Repeatedly send the current time
-  //
-
-  if (role == role_ping_out)
-  {
-    // First, stop listening so we can talk.
-    rf24_stopListening();
-
-    // Take the time, and send it.  This will block until complete
-    unsigned long time = __millis();
-    printf("Now sending %lu...",time);
-    bool ok = rf24_write( &time, sizeof(unsigned long) );
-    
-    if (ok)
-      printf("ok...");
-    else
-      printf("failed.\n\r");
-
-    // Now, continue listening
-    rf24_startListening();
-
-    // Wait here until we get a response, or timeout (250ms)
-    unsigned long started_waiting_at = __millis();
-    bool timeout = FALSE;
-    while ( ! rf24_available(NULL) && ! timeout ) {
-	// by bcatalin » Thu Feb 14, 2013 11:26 am 
-	__msleep(5); //add a small delay to let rf24_available to check payload
-      if (__millis() - started_waiting_at > 200 )
-        timeout = TRUE;
-    }
-
-    // Describe the results
-    if ( timeout )
-    {
-      printf("Failed, response timed out.\n\r");
-    }
-    else
-    {
-      // Grab the response, compare, and send to debugging spew
-      unsigned long got_time;
-      rf24_read( &got_time, sizeof(unsigned long) );
-
-      // Spew it
-      printf("Got response %lu, round-trip delay: %lu\n\r",got_time,__millis()-got_time);
-    }
-
-    // Try again 1s later
-//    delay(1000);
-_msleep(1000);
-  }
-
-  //
-  // Pong back role.  Receive each packet, dump it out, and send it back
-  //
-
-  if ( role == role_pong_back )
-  {
-    // if there is data ready
-    if ( rf24_available(NULL) )
-    {
-      // Dump the payloads until we've gotten everything
-      unsigned long got_time;
-      bool done = FALSE;
-      while (!done)
-      {
-        // Fetch the payload, and see if this was the last one.
-        done = rf24_read( &got_time, sizeof(unsigned long) );
-
-        // Spew it
-        printf("Got payload %lu...",got_time);
-
-	// Delay just a little bit to let the other unit
-	// make the transition to receiver
-	delay(20);
-      }
-
-      // First, stop listening so we can talk
-      rf24_stopListening();
-
-      // Send the final one back.
-      printf("Sent response.\n\r");
-      rf24_write( &got_time, sizeof(unsigned long) );
-
-      // Now, resume listening so we catch the next packets.
-      rf24_startListening();
+void loop(void) {
+    unsigned long time, got_time;
+    uint8_t from[5];
+
+    if (role == role_ping_out) {
+        /* Take the time, and send it */
+        time = millis();
+        printf("Now sending %lu...", time);
+        rf24_send(radio, addresses[1], &time, sizeof(time));
+
+        /* Wait here until we get a response, or timeout (200ms) */
+        if (rf24_recvfrom_timed(radio, &got_time, sizeof(got_time), from, 200) != sizeof(got_time))
+            printf("Failed, response timed out.\n");
+        else
+            printf("Got response %lu, round-trip delay: %lu\n", got_time, millis() - got_time);
+
+        /* Try again 1s later */
+        milliSleep(1000);
+    } else {
+        /* Dump each payload and send it back to whoever sent it */
+        if (rf24_recvfrom(radio, &got_time, sizeof(got_time), from, 1) != sizeof(got_time)) return;
+        printf("Got payload %lu...", got_time);
+        rf24_send(radio, from, &got_time, sizeof(got_time));
+        printf("Sent response.\n");
     }
-  }
 }
 
-int main(int argc, char** argv)
-{
-        setup();
-        while(1)
-                loop();
-
-        return 0;
+int main(int argc, char **argv) {
+    role = (argc > 1 && strcmp(argv[1], "pong") == 0) ? role_pong_back : role_ping_out;
+    setup();
+    while (1) {
+        loop();
+    }
+    return 0;
 }
-
-
-// vim:cin:ai:sts=2 sw=2 ft=cpp
@@ -0,0 +1,248 @@
+/* Checks which received frame each queued ACK payload is credited to,
+ * against a simulated radio standing in for the SPI and GPIO calls rf24.c
+ * makes. Frames are put in the RX FIFO by hand and drained by calling the
+ * interrupt thread's retrieve_packets() in place of an IRQ */
+#include "rf24.h"
+#include "spi.h"
+#include "gpio.h"
+#include "nRF24L01.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+
+#define FIFO_DEPTH 3
+#define PENDING -1
+
+void retrieve_packets(RF24Ctx *ctx);
+
+typedef struct fifo_entry {
+  uint8_t pipe;
+  uint8_t len;
+  uint8_t data[MAX_PAYLOAD_LEN];
+} FifoEntry;
+
+/* The radio's side of the bus */
+struct spi_state {
+  pthread_mutex_t lock;
+  uint8_t regs[32];
+  uint8_t flags; /* RX_DR/TX_DS/MAX_RT in STATUS */
+  FifoEntry rx[FIFO_DEPTH], tx[FIFO_DEPTH]; /* tx only holds ACK payloads here */
+  int rx_count, tx_count;
+} radio_sim = {PTHREAD_MUTEX_INITIALIZER, {0}, 0, {{0}}, {{0}}, 0, 0};
+
+struct gpio_line {
+  int fds[2];
+};
+
+int failed, results[2] = {PENDING, PENDING};
+
+uint8_t sim_status(void) {
+  struct spi_state *r = &radio_sim;
+  return r->flags | (r->rx_count ? r->rx[0].pipe << 1 : RX_P_NO) | (r->tx_count == FIFO_DEPTH);
+}
+
+uint8_t sim_fifo_status(void) {
+  struct spi_state *r = &radio_sim;
+  return (r->rx_count ? 0 : RX_EMPTY) | (r->rx_count == FIFO_DEPTH ? RX_FULL : 0) |
+         (r->tx_count ? 0 : TX_EMPTY) | (r->tx_count == FIFO_DEPTH ? TX_FULL : 0);
+}
+
+/* One chip select delimited command */
+void sim_command(const uint8_t *tx, uint8_t *rx, uint8_t len) {
+  struct spi_state *r = &radio_sim;
+  uint8_t out[MAX_PAYLOAD_LEN + 1], cmd = tx[0], reg = tx[0] & REGISTER_MASK, i;
+  memset(out, 0, sizeof(out));
+  out[0] = sim_status();
+  if (cmd == R_RX_PAYLOAD) {
+    if (r->rx_count) {
+      memcpy(out + 1, r->rx[0].data, len - 1);
+      memmove(r->rx, r->rx + 1, --r->rx_count * sizeof(FifoEntry));
+    }
+  } else if (cmd == R_RX_PL_WID) {
+    out[1] = (r->rx_count ? r->rx[0].len : 0);
+  } else if ((cmd & 0xF8) == W_ACK_PAYLOAD) {
+    for (i = 0; i < r->tx_count; i++)
+      if (r->tx[i].pipe == (cmd & 0x07)) failed = printf("second ACK payload loaded on pipe %d\n", cmd & 0x07);
+    if (r->tx_count == FIFO_DEPTH) failed = printf("ACK payload written to a full TX FIFO\n");
+    else {
+      r->tx[r->tx_count].pipe = cmd & 0x07;
+      r->tx[r->tx_count].len = len - 1;
+      memcpy(r->tx[r->tx_count++].data, tx + 1, len - 1);
+    }
+  } else if (cmd == FLUSH_TX) {
+    r->tx_count = 0;
+  } else if (cmd == FLUSH_RX) {
+    r->rx_count = 0;
+  } else if (cmd == NOP || cmd == ACTIVATE) {
+  } else if ((cmd & 0xE0) == W_REGISTER) {
+    if (reg == STATUS) r->flags &= ~(tx[1] & (RX_DR | TX_DS | MAX_RT));
+    else r->regs[reg] = tx[1];
+  } else if ((cmd & 0xE0) == R_REGISTER) {
+    for (i = 1; i < len; i++)
+      out[i] = (reg == FIFO_STATUS ? sim_fifo_status() : reg == STATUS ? out[0] : r->regs[reg]);
+  }
+  if (rx) memcpy(rx, out, len);
+}
+
+/* A node's frame of len bytes lands on pipe and is ACKed, taking the
+ * first ACK payload loaded for the pipe. Returns that payload's first
+ * byte, or 0 if the ACK went empty */
+uint8_t air_frame(uint8_t pipe, uint8_t len) {
+  struct spi_state *r = &radio_sim;
+  uint8_t carried = 0;
+  int i;
+  pthread_mutex_lock(&r->lock);
+  if (r->rx_count < FIFO_DEPTH) {
+    r->rx[r->rx_count].pipe = pipe;
+    r->rx[r->rx_count].len = len;
+    memset(r->rx[r->rx_count++].data, 0x42, len);
+    r->flags |= RX_DR;
+  }
+  for (i = 0; i < r->tx_count && r->tx[i].pipe != pipe; i++);
+  if (i < r->tx_count) {
+    carried = r->tx[i].data[0];
+    memmove(r->tx + i, r->tx + i + 1, (--r->tx_count - i) * sizeof(FifoEntry));
+  }
+  pthread_mutex_unlock(&r->lock);
+  return carried;
+}
+
+/* Payloads waiting in the TX FIFO, as their first bytes */
+void loaded(char *out) {
+  int i;
+  pthread_mutex_lock(&radio_sim.lock);
+  for (i = 0; i < radio_sim.tx_count; i++) out[i] = radio_sim.tx[i].data[0];
+  out[i] = '\0';
+  pthread_mutex_unlock(&radio_sim.lock);
+}
+
+SPIState *spi_init(char *device, uint32_t mode, uint8_t bits, uint32_t speed, uint8_t chip_select) {
+  (void)device; (void)mode; (void)bits; (void)speed; (void)chip_select;
+  return &radio_sim;
+}
+
+void spi_enable(SPIState *spi) {
+  pthread_mutex_lock(&spi->lock);
+}
+
+void spi_disable(SPIState *spi) {
+  pthread_mutex_unlock(&spi->lock);
+}
+
+uint8_t spi_transfer_bulk(SPIState *spi, const uint8_t *tx, uint8_t *rx, uint8_t len) {
+  (void)spi;
+  sim_command(tx, rx, len);
+  return 1;
+}
+
+uint8_t spi_transfer_seq(SPIState *spi, const SPIMessage *msgs, uint8_t count) {
+  uint8_t i;
+  pthread_mutex_lock(&spi->lock);
+  for (i = 0; i < count; i++) sim_command(msgs[i].tx, msgs[i].rx, msgs[i].len);
+  pthread_mutex_unlock(&spi->lock);
+  return 1;
+}
+
+void spi_close(SPIState *spi) {
+  (void)spi;
+}
+
+/* The IRQ line never fires, so the interrupt thread just waits */
+int gpio_set_backend(int backend, const char *chip) {
+  (void)backend; (void)chip;
+  return 1;
+}
+
+GPIOLine *gpio_line_open(int port, int dir) {
+  GPIOLine *line = (GPIOLine *)malloc(sizeof(GPIOLine));
+  (void)port; (void)dir;
+  if (pipe(line->fds) < 0) {
+    free(line);
+    return NULL;
+  }
+  return line;
+}
+
+void gpio_line_close(GPIOLine *line) {
+  close(line->fds[0]);
+  close(line->fds[1]);
+  free(line);
+}
+
+int gpio_line_write(GPIOLine *line, int val) {
+  (void)line; (void)val;
+  return 1;
+}
+
+int gpio_line_enable_edge(GPIOLine *line, int edge) {
+  (void)line; (void)edge;
+  return 1;
+}
+
+int gpio_line_fd(GPIOLine *line) {
+  return line->fds[0];
+}
+
+short gpio_line_events(GPIOLine *line) {
+  (void)line;
+  return POLLIN;
+}
+
+int gpio_line_read_event(GPIOLine *line, uint64_t *ts) {
+  uint8_t c;
+  (void)ts;
+  return read(line->fds[0], &c, 1) == 1;
+}
+
+void ack_done(rf24_tx_result_e result, void *arg) {
+  results[(long)arg] = result;
+}
+
+void expect_loaded(const char *want, const char *when) {
+  char got[FIFO_DEPTH + 1];
+  loaded(got);
+  if (strcmp(got, want)) failed = printf("%s: TX FIFO holds \"%s\", expected \"%s\"\n", when, got, want);
+}
+
+void expect_results(int a, int b, const char *when) {
+  if (results[0] != a || results[1] != b)
+    failed = printf("%s: results %d %d, expected %d %d\n", when, results[0], results[1], a, b);
+}
+
+int main(int argc, char const *argv[]) {
+  RF24Ctx *radio;
+  (void)argc; (void)argv;
+  if ((radio = rf24_init_radio("/dev/spidev0.0", 8000000, 25)) == NULL) return 1;
+  rf24_startListening(radio);
+
+  /* Two frames wait in the RX FIFO, ACKed before anything was queued */
+  air_frame(1, 8);
+  air_frame(1, 8);
+  rf24_queueAckPayload(radio, 1, "A", 1, ack_done, (void *)0);
+  rf24_queueAckPayload(radio, 1, "B", 1, ack_done, (void *)1);
+  expect_loaded("A", "queued behind waiting frames");
+  retrieve_packets(radio);
+  expect_loaded("A", "waiting frames drained");
+  expect_results(PENDING, PENDING, "waiting frames drained");
+
+  /* The next frame takes A, the one after shows the node got it. That one
+   * is too short to carry a sender and is dropped, but still takes B */
+  if (air_frame(1, 8) != 'A') failed = printf("A not sent with the next ACK\n");
+  retrieve_packets(radio);
+  expect_loaded("B", "A went out");
+  expect_results(PENDING, PENDING, "A went out");
+  if (air_frame(1, 2) != 'B') failed = printf("B not sent with the next ACK\n");
+  retrieve_packets(radio);
+  expect_loaded("", "B went out");
+  expect_results(RF24_TX_ACKED, PENDING, "B went out");
+  air_frame(1, 8);
+  retrieve_packets(radio);
+  expect_results(RF24_TX_ACKED, RF24_TX_ACKED, "node moved on");
+
+  rf24_close(radio);
+  printf("%s\n", failed ? "FAILED" : "ok");
+  return failed != 0;
+}
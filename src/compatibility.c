@@ -1,3 +1,8 @@
+#define _GNU_SOURCE /* pthread_attr_setaffinity_np() */
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <errno.h>
 #include "compatibility.h"
 
 static struct timeval start, end;
@@ -34,4 +39,63 @@ long millis() {
     useconds = end.tv_usec - start.tv_usec;
     mtime = ((seconds) * 1000 + useconds/1000.0) + 0.5;	
 	return mtime;
-}
\ No newline at end of file
+}
+
+/* Nanoseconds on CLOCK_MONOTONIC, the clock GPIO edge timestamps use */
+uint64_t monotonic_ns() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* Absolute CLOCK_REALTIME time millisec from now, for pthread timed waits */
+void deadline_after(struct timespec *ts, int millisec) {
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_sec += millisec / 1000;
+	ts->tv_nsec += (millisec % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+/* Starts a thread with the given scheduling. If real-time scheduling or
+ * pinning is refused (e.g. no CAP_SYS_NICE) it warns and falls back to a
+ * normal thread rather than failing */
+int thread_create(pthread_t *thread, const ThreadOpts *opts, void *(*start)(void *), void *arg) {
+	pthread_attr_t attr;
+	struct sched_param param = {.sched_priority = opts->priority};
+	cpu_set_t cpus;
+	int err;
+	pthread_attr_init(&attr);
+	if (opts->stack_size) pthread_attr_setstacksize(&attr, opts->stack_size);
+	if (opts->priority > 0) {
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+	if (opts->cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(opts->cpu, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+	err = pthread_create(thread, &attr, start, arg);
+	if (err == EPERM || err == EINVAL) {
+		fprintf(stderr, "thread_create: %s, using default scheduling\n", strerror(err));
+		pthread_attr_destroy(&attr);
+		pthread_attr_init(&attr);
+		if (opts->stack_size) pthread_attr_setstacksize(&attr, opts->stack_size);
+		err = pthread_create(thread, &attr, start, arg);
+	}
+	pthread_attr_destroy(&attr);
+	return err == 0;
+}
+
+#define PREFAULT_STACK_SIZE (16 * 1024)
+
+/* Touches the calling thread's stack so that, with memory locked, the
+ * first interrupt doesn't take page faults */
+void prefault_stack() {
+	volatile char stack[PREFAULT_STACK_SIZE];
+	memset((char *)stack, 0, sizeof(stack));
+}
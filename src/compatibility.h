@@ -9,6 +9,15 @@
 #define	COMPATIBLITY_H
 	
 #include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* Scheduling for the library's threads, see thread_create() */
+typedef struct thread_opts {
+	int priority; /* SCHED_FIFO priority, 0 for the default scheduler */
+	int cpu; /* Core to pin to, -1 to run anywhere */
+	size_t stack_size; /* 0 for the default */
+} ThreadOpts;
 #include <time.h>
 #include <sys/time.h>
 
@@ -17,5 +26,9 @@ void microSleep(int millisec);
 void secSleep(int sec);
 void start_timer();
 long millis();
+uint64_t monotonic_ns();
+void deadline_after(struct timespec *ts, int millisec);
+int thread_create(pthread_t *thread, const ThreadOpts *opts, void *(*start)(void *), void *arg);
+void prefault_stack();
 
 #endif	/* COMPATIBLITY_H */
\ No newline at end of file
@@ -1,66 +1,263 @@
 #include "gpio.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
 /* Status values */
 #define ERROR 0
 #define OK 1
+#define CONSUMER "rf24"
 
-int gpio_open(int port, int dir) {
-	char path[40];
-	FILE *f = fopen("/sys/class/gpio/export", "w");
-	if (f == NULL) return ERROR;
-	fprintf(f, "%d\n", port);
-	fclose(f);
-	
-	sprintf(path, "/sys/class/gpio/gpio%d/direction", port);
-	f = fopen(path, "w");
-	if (f == NULL) return ERROR;
-	fprintf(f, "%s\n", (dir ? "out" : "in"));
-	fclose(f);
+typedef struct gpio_line {
+	int port;
+	int backend;
+	int fd; /* Open value file or line request */
+} GPIOLine;
+
+/* Lines opened through the int port functions */
+static GPIOLine *lines[GPIO_MAX_PORT];
+static int backend = GPIO_BACKEND_SYSFS;
+static int chip_fd = -1;
+static char chip_name[64];
+static int open_lines; /* Lines opened on the current backend and chip */
+
+/* Whether backend and chip are the ones in use */
+static int backend_matches(int new_backend, const char *chip) {
+	if (new_backend != backend) return 0;
+	return (backend == GPIO_BACKEND_SYSFS || (chip_fd >= 0 && !strcmp(chip, chip_name)));
+}
+
+int gpio_set_backend(int new_backend, const char *chip) {
+	int fd;
+	if (new_backend == GPIO_BACKEND_CDEV && chip == NULL) return ERROR;
+	if (backend_matches(new_backend, chip)) return OK;
+	if (open_lines > 0) return ERROR; /* Open lines would be left on the old one */
+	switch (new_backend) {
+		case(GPIO_BACKEND_SYSFS): break;
+		case(GPIO_BACKEND_CDEV):
+			if (strlen(chip) >= sizeof(chip_name)) return ERROR;
+			fd = open(chip, O_RDWR | O_CLOEXEC);
+			if (fd < 0) return ERROR;
+			if (chip_fd >= 0) close(chip_fd);
+			chip_fd = fd;
+			strcpy(chip_name, chip);
+			break;
+		default: return ERROR;
+	}
+	backend = new_backend;
 	return OK;
 }
 
-int gpio_close(int port) {
-	FILE *f = fopen("/sys/class/gpio/unexport", "w");
+/*****************/
+/* sysfs backend */
+/*****************/
+static int sysfs_write(const char *path, const char *val) {
+	FILE *f = fopen(path, "w");
 	if (f == NULL) return ERROR;
-	fprintf(f, "%d\n", port);
+	fprintf(f, "%s\n", val);
 	fclose(f);
 	return OK;
 }
 
-int gpio_read(int port, int *val) {
-	FILE *f;
+static GPIOLine *line_attach(int port, int flags) {
 	char path[40];
+	GPIOLine *line = (GPIOLine *)malloc(sizeof(GPIOLine));
+	if (line == NULL) return NULL;
 	sprintf(path, "/sys/class/gpio/gpio%d/value", port);
-	f = fopen(path, "r");
-	if (f == NULL) return ERROR;
-	fscanf(f, "%d", val);
-	fclose(f);
+	line->port = port;
+	line->backend = GPIO_BACKEND_SYSFS;
+	line->fd = open(path, flags);
+	if (line->fd < 0) {
+		free(line);
+		return NULL;
+	}
+	__sync_fetch_and_add(&open_lines, 1);
+	return line;
+}
+
+static GPIOLine *sysfs_open(int port, int dir) {
+	char path[40], num[8];
+	sprintf(num, "%d", port);
+	if (!sysfs_write("/sys/class/gpio/export", num)) return NULL;
+	sprintf(path, "/sys/class/gpio/gpio%d/direction", port);
+	if (!sysfs_write(path, (dir ? "out" : "in"))) return NULL;
+	return line_attach(port, (dir ? O_RDWR : O_RDONLY));
+}
+
+static int sysfs_enable_edge(GPIOLine *line, int edge) {
+	static const char * const edges[] = {"none", "falling", "rising", "both"};
+	char path[40];
+	sprintf(path, "/sys/class/gpio/gpio%d/edge", line->port);
+	return sysfs_write(path, edges[edge]);
+}
+
+static int sysfs_read_event(GPIOLine *line, uint64_t *ts) {
+	struct timespec now;
+	int val;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	/* Reading the value from the start re-arms POLLPRI */
+	if (!gpio_line_read(line, &val)) return 0;
+	if (ts) *ts = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+	return (val ? GPIO_RISING_EDGE : GPIO_FALLING_EDGE);
+}
+
+/****************/
+/* cdev backend */
+/****************/
+static GPIOLine *cdev_open(int port, int dir) {
+	struct gpio_v2_line_request req;
+	GPIOLine *line;
+	if (chip_fd < 0) return NULL;
+	memset(&req, 0, sizeof(req));
+	req.offsets[0] = port;
+	req.num_lines = 1;
+	strncpy(req.consumer, CONSUMER, sizeof(req.consumer) - 1);
+	req.config.flags = (dir ? GPIO_V2_LINE_FLAG_OUTPUT : GPIO_V2_LINE_FLAG_INPUT);
+	if (ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) return NULL;
+	line = (GPIOLine *)malloc(sizeof(GPIOLine));
+	if (line == NULL) {
+		close(req.fd);
+		return NULL;
+	}
+	line->port = port;
+	line->backend = GPIO_BACKEND_CDEV;
+	line->fd = req.fd;
+	__sync_fetch_and_add(&open_lines, 1);
+	return line;
+}
+
+static int cdev_enable_edge(GPIOLine *line, int edge) {
+	struct gpio_v2_line_config config;
+	memset(&config, 0, sizeof(config));
+	config.flags = GPIO_V2_LINE_FLAG_INPUT;
+	if (edge & GPIO_FALLING_EDGE) config.flags |= GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	if (edge & GPIO_RISING_EDGE) config.flags |= GPIO_V2_LINE_FLAG_EDGE_RISING;
+	return (ioctl(line->fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0 ? ERROR : OK);
+}
+
+static int cdev_read_event(GPIOLine *line, uint64_t *ts) {
+	struct gpio_v2_line_event event;
+	if (read(line->fd, &event, sizeof(event)) != sizeof(event)) return 0;
+	if (ts) *ts = event.timestamp_ns;
+	return (event.id == GPIO_V2_LINE_EVENT_RISING_EDGE ? GPIO_RISING_EDGE : GPIO_FALLING_EDGE);
+}
+
+/*****************/
+/* Line handles  */
+/*****************/
+GPIOLine *gpio_line_open(int port, int dir) {
+	return (backend == GPIO_BACKEND_CDEV ? cdev_open(port, dir) : sysfs_open(port, dir));
+}
+
+void gpio_line_close(GPIOLine *line) {
+	char num[8];
+	if (line == NULL) return;
+	close(line->fd);
+	__sync_fetch_and_sub(&open_lines, 1);
+	if (line->backend == GPIO_BACKEND_SYSFS) {
+		sprintf(num, "%d", line->port);
+		sysfs_write("/sys/class/gpio/unexport", num);
+	}
+	free(line);
+}
+
+int gpio_line_read(GPIOLine *line, int *val) {
+	struct gpio_v2_line_values values = {.bits = 0, .mask = 1};
+	char c;
+	if (line->backend == GPIO_BACKEND_CDEV) {
+		if (ioctl(line->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) return ERROR;
+		*val = values.bits & 1;
+		return OK;
+	}
+	if (pread(line->fd, &c, 1, 0) != 1) return ERROR;
+	*val = (c == '1');
 	return OK;
 }
 
-int gpio_write(int port, int val){
-	FILE *f;
-	char file[40];
-	sprintf(file, "/sys/class/gpio/gpio%d/value", port);
-	f = fopen(file, "w");
-	if (f == NULL) return ERROR;
-	fprintf(f, "%s\n", (val ? "1" : "0"));
-	fclose(f);
+int gpio_line_write(GPIOLine *line, int val) {
+	struct gpio_v2_line_values values = {.bits = (val ? 1 : 0), .mask = 1};
+	if (line->backend == GPIO_BACKEND_CDEV)
+		return (ioctl(line->fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0 ? ERROR : OK);
+	return (pwrite(line->fd, (val ? "1" : "0"), 1, 0) == 1 ? OK : ERROR);
+}
+
+int gpio_line_enable_edge(GPIOLine *line, int edge) {
+	if (edge < GPIO_NO_EDGE || edge > GPIO_BOTH_EDGES) return ERROR;
+	if (line->backend == GPIO_BACKEND_CDEV) return cdev_enable_edge(line, edge);
+	return sysfs_enable_edge(line, edge);
+}
+
+int gpio_line_fd(GPIOLine *line) {
+	return line->fd;
+}
+
+short gpio_line_events(GPIOLine *line) {
+	return (line->backend == GPIO_BACKEND_CDEV ? POLLIN : POLLPRI);
+}
+
+int gpio_line_read_event(GPIOLine *line, uint64_t *ts) {
+	if (line->backend == GPIO_BACKEND_CDEV) return cdev_read_event(line, ts);
+	return sysfs_read_event(line, ts);
+}
+
+/*****************/
+/* Int ports     */
+/*****************/
+/* Finds the line for an int port, attaching to an already exported port
+ * that was not opened through gpio_open() */
+static GPIOLine *line_lookup(int port) {
+	if (port < 0 || port >= GPIO_MAX_PORT) return NULL;
+	if (lines[port] == NULL && backend == GPIO_BACKEND_SYSFS)
+		lines[port] = line_attach(port, O_RDWR);
+	return lines[port];
+}
+
+int gpio_open(int port, int dir) {
+	GPIOLine *line;
+	if (port < 0 || port >= GPIO_MAX_PORT) return ERROR;
+	if (lines[port]) { /* Drop our old handle first, cdev lines are exclusive */
+		close(lines[port]->fd);
+		free(lines[port]);
+		lines[port] = NULL;
+		__sync_fetch_and_sub(&open_lines, 1);
+	}
+	line = gpio_line_open(port, dir);
+	if (line == NULL) return ERROR;
+	lines[port] = line;
 	return OK;
 }
 
+int gpio_close(int port) {
+	char num[8];
+	if (port < 0 || port >= GPIO_MAX_PORT) return ERROR;
+	if (lines[port]) {
+		gpio_line_close(lines[port]);
+		lines[port] = NULL;
+		return OK;
+	}
+	sprintf(num, "%d", port);
+	return sysfs_write("/sys/class/gpio/unexport", num);
+}
+
+int gpio_read(int port, int *val) {
+	GPIOLine *line = line_lookup(port);
+	if (line == NULL) return ERROR;
+	return gpio_line_read(line, val);
+}
+
+int gpio_write(int port, int val){
+	GPIOLine *line = line_lookup(port);
+	if (line == NULL) return ERROR;
+	return gpio_line_write(line, val);
+}
+
 int gpio_enable_edge(int port, int edge){
-	FILE *f;
-	char file[40];
-	sprintf (file, "/sys/class/gpio/gpio%d/edge", port) ;
-  	f = fopen(file, "w");
-  	if (f == NULL) return ERROR;
-  	switch(edge) {
-  		case(0): fprintf(f, "none\n"); break;
-  		case(1): fprintf(f, "falling\n"); break;
-  		case(2): fprintf(f, "rising\n"); break;
-  		case(3): fprintf(f, "both\n"); break;
-  	}
-  	fclose(f);
-  	return OK;
-}
\ No newline at end of file
+	GPIOLine *line = line_lookup(port);
+	if (line == NULL) return ERROR;
+	return gpio_line_enable_edge(line, edge);
+}
@@ -1,5 +1,9 @@
 #ifndef GPIO_H
 #define	GPIO_H
+#include <stdint.h>
+/* GPIO backends */
+#define GPIO_BACKEND_SYSFS 0 /* /sys/class/gpio, deprecated */
+#define GPIO_BACKEND_CDEV 1 /* /dev/gpiochipN, uAPI v2 */
 /* GPIO pin directions */
 #define GPIO_IN 0
 #define GPIO_OUT 1
@@ -11,6 +15,49 @@
 #define GPIO_FALLING_EDGE 1
 #define GPIO_RISING_EDGE 2
 #define GPIO_BOTH_EDGES 3
+/* Highest port number usable through the int port functions */
+#define GPIO_MAX_PORT 64
+
+typedef struct gpio_line GPIOLine; /* opaque type definition */
+
+/* Selects the backend used by lines opened from now on. chip names the
+ * character device, e.g. "/dev/gpiochip0", and is ignored for sysfs.
+ * The backend is shared by every line, so while any are open only the
+ * one already in use can be selected
+ * returns 1 if successful, 0 otherwise */
+int gpio_set_backend(int backend, const char *chip);
+
+/* Exports the specified port as an input or output and keeps its value
+ * file open for the lifetime of the line
+ * returns the line if successful, NULL otherwise */
+GPIOLine *gpio_line_open(int port, int dir);
+
+/* Unexports the line's port and frees the line */
+void gpio_line_close(GPIOLine *line);
+
+/* Reads the line into the provided val
+ * returns 1 if successful, 0 otherwise */
+int gpio_line_read(GPIOLine *line, int *val);
+
+/* Writes val to the line with a single syscall
+ * returns 1 if successful, 0 otherwise */
+int gpio_line_write(GPIOLine *line, int val);
+
+/* Sets which edges of the line raise an event on its fd
+ * returns 1 if successful, 0 otherwise */
+int gpio_line_enable_edge(GPIOLine *line, int edge);
+
+/* Returns the fd backing the line, for use with poll() */
+int gpio_line_fd(GPIOLine *line);
+
+/* Returns the poll() events that signal a pending edge on the line's fd */
+short gpio_line_events(GPIOLine *line);
+
+/* Consumes one pending edge event, storing when it occurred in ns on
+ * CLOCK_MONOTONIC into ts if non NULL. The cdev backend reports the
+ * kernel's timestamp, sysfs can only report when the event was read
+ * returns GPIO_RISING_EDGE or GPIO_FALLING_EDGE, 0 otherwise */
+int gpio_line_read_event(GPIOLine *line, uint64_t *ts);
 
 /* Opens the specified port as an input or output
  * returns 1 if successful, 0 otherwise */
@@ -31,4 +78,3 @@ int gpio_write(int port, int val);
 int gpio_enable_edge(int port, int edge);
 
 #endif	/* GPIO_H */
-
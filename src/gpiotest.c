@@ -0,0 +1,65 @@
+/* Exercises the cdev GPIO backend against a simulated chip, e.g.
+ *   modprobe gpio-mockup gpio_mockup_ranges=-1,8
+ *   ./gpiotest /dev/gpiochipN /sys/kernel/debug/gpio-mockup/gpiochipN/1
+ * Line 0 is driven as an output and read back, line 1 is an edge input
+ * whose pull is toggled through the simulator's control file. */
+#include "gpio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+
+static void pull(const char *path, int val) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) return;
+  fprintf(f, "%d\n", val);
+  fclose(f);
+}
+
+int main(int argc, char const *argv[]) {
+  GPIOLine *out, *in;
+  struct pollfd pfd;
+  uint64_t ts, last_ts = 0;
+  int i, val, edge, fail = 0;
+  if (argc < 3) {
+    printf("usage: %s <gpiochip> <line 1 pull file>\n", argv[0]);
+    return 1;
+  }
+  if (!gpio_set_backend(GPIO_BACKEND_CDEV, argv[1])) {
+    perror("gpio_set_backend");
+    return 1;
+  }
+  out = gpio_line_open(0, GPIO_OUT);
+  in = gpio_line_open(1, GPIO_IN);
+  if (out == NULL || in == NULL) {
+    perror("gpio_line_open");
+    return 1;
+  }
+  for (i = 0; i < 4; i++) {
+    gpio_line_write(out, i & 1);
+    gpio_line_read(out, &val);
+    printf("write %d read %d\n", i & 1, val);
+    if (val != (i & 1)) fail++;
+  }
+
+  pull(argv[2], 1);
+  gpio_line_enable_edge(in, GPIO_FALLING_EDGE);
+  pfd.fd = gpio_line_fd(in);
+  pfd.events = gpio_line_events(in);
+  for (i = 0; i < 4; i++) {
+    pull(argv[2], 0);
+    if (poll(&pfd, 1, 1000) != 1) {
+      printf("no edge event\n");
+      fail++;
+      break;
+    }
+    edge = gpio_line_read_event(in, &ts);
+    printf("edge %d at %llu ns\n", edge, (unsigned long long)ts);
+    if (edge != GPIO_FALLING_EDGE || ts <= last_ts) fail++;
+    last_ts = ts;
+    pull(argv[2], 1);
+  }
+  gpio_line_close(out);
+  gpio_line_close(in);
+  printf("%s\n", (fail ? "FAIL" : "PASS"));
+  return fail;
+}
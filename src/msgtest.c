@@ -0,0 +1,72 @@
+#include "rf24msg.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MSG_LEN 100
+
+uint8_t alice[ADDR_WIDTH] = {1, 1, 1, 1, 1};
+uint8_t bob[ADDR_WIDTH] = {2, 2, 2, 2, 2};
+
+/* Builds fragment index of a message the way rf24msg_send() does, padded
+ * out to a full frame as a fixed payload length would */
+uint8_t fragment(uint8_t *frame, uint8_t id, uint8_t index, const uint8_t *msg, uint16_t len) {
+  uint16_t offset = index * RF24MSG_FRAG_DATA;
+  memset(frame, 0xEE, RF24MSG_HEADER_LEN + RF24MSG_FRAG_DATA);
+  frame[0] = id;
+  frame[1] = index;
+  frame[2] = len & 0xFF;
+  frame[3] = len >> 8;
+  memcpy(frame + RF24MSG_HEADER_LEN, msg + offset,
+         (len - offset < RF24MSG_FRAG_DATA ? len - offset : RF24MSG_FRAG_DATA));
+  return RF24MSG_HEADER_LEN + RF24MSG_FRAG_DATA;
+}
+
+int main(int argc, char const *argv[]) {
+  uint8_t msg[MSG_LEN], other[MSG_LEN], out[MSG_LEN], frame[32];
+  uint8_t order[] = {4, 0, 2, 2, 1, 3}; /* Out of order, with a repeat */
+  uint16_t len = 0;
+  RF24MsgStats stats;
+  RF24MsgCtx *m;
+  int i, failed = 0;
+  (void)argc; (void)argv;
+  for (i = 0; i < MSG_LEN; i++) {
+    msg[i] = i;
+    other[i] = 255 - i;
+  }
+
+  m = rf24msg_create(NULL, 2, MSG_LEN, 50);
+  for (i = 0; i < (int)sizeof(order); i++) {
+    len = rf24msg_input(m, alice, frame, fragment(frame, 7, order[i], msg, MSG_LEN), out, sizeof(out));
+    if (len && i != (int)sizeof(order) - 1) failed = printf("completed early at %d\n", i);
+  }
+  if (len != MSG_LEN || memcmp(out, msg, MSG_LEN)) failed = printf("reassembly failed\n");
+
+  /* Two senders interleaved */
+  for (i = 0; i < 5; i++) {
+    if (rf24msg_input(m, alice, frame, fragment(frame, 8, i, msg, MSG_LEN), out, sizeof(out)) &&
+        memcmp(out, msg, MSG_LEN)) failed = printf("alice's message corrupted\n");
+    if (rf24msg_input(m, bob, frame, fragment(frame, 8, i, other, MSG_LEN), out, sizeof(out)) &&
+        memcmp(out, other, MSG_LEN)) failed = printf("bob's message corrupted\n");
+  }
+
+  /* Both buffers busy, a third sender is turned away until they time out */
+  rf24msg_input(m, alice, frame, fragment(frame, 9, 0, msg, MSG_LEN), out, sizeof(out));
+  rf24msg_input(m, bob, frame, fragment(frame, 9, 0, msg, MSG_LEN), out, sizeof(out));
+  rf24msg_input(m, (uint8_t *)"\3\3\3\3\3", frame, fragment(frame, 1, 0, msg, MSG_LEN), out, sizeof(out));
+  usleep(60 * 1000);
+  for (i = 0; i < 5; i++)
+    len = rf24msg_input(m, (uint8_t *)"\3\3\3\3\3", frame, fragment(frame, 1, i, msg, MSG_LEN), out, sizeof(out));
+  if (len != MSG_LEN) failed = printf("buffers not freed by the timeout\n");
+
+  /* A short last fragment claiming more than it carries */
+  if (rf24msg_input(m, alice, frame, 10, out, sizeof(out))) failed = printf("accepted a short fragment\n");
+
+  rf24msg_getStats(m, &stats);
+  printf("delivered %u timed out %u replaced %u no buffer %u duplicates %u malformed %u\n",
+         stats.delivered, stats.timed_out, stats.replaced, stats.no_buffer, stats.duplicates, stats.malformed);
+  if (stats.delivered != 4 || stats.timed_out != 2 || stats.no_buffer != 1 ||
+      stats.duplicates != 1 || stats.malformed != 1) failed = printf("unexpected stats\n");
+  rf24msg_destroy(m);
+  return failed != 0;
+}
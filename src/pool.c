@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "pool.h"
+
+#define ALIGN 8
+#define INDEX(_top) ((uint32_t)(_top))
+#define TAG(_top) ((_top) >> 32)
+/* Tagging the free list head with a counter stops a slot being freed and
+ * reallocated between another thread's load and compare-exchange (ABA) */
+#define TOP(_tag, _index) (((uint64_t)(_tag) << 32) | (_index))
+
+typedef struct pool {
+  int count;
+  int elem_size;
+  char *slab;
+  atomic_uint *next; /* Free list links, 1-based index, 0 ends the list */
+  _Atomic uint64_t top;
+  atomic_int available;
+  atomic_uint exhausted;
+} Pool;
+
+Pool *pool_create(int count, int elem_size) {
+  int i;
+  Pool *p = (Pool *)malloc(sizeof(Pool));
+  if (p == NULL) return NULL;
+  p->count = count;
+  p->elem_size = (elem_size + ALIGN - 1) & ~(ALIGN - 1);
+  p->slab = (char *)calloc(count, p->elem_size);
+  p->next = (atomic_uint *)malloc(count * sizeof(atomic_uint));
+  if (p->slab == NULL || p->next == NULL) {
+    free(p->slab);
+    free(p->next);
+    free(p);
+    return NULL;
+  }
+  for (i = 0; i < count; i++) atomic_init(&p->next[i], (i + 1 < count ? i + 2 : 0));
+  atomic_init(&p->top, TOP(0, (count ? 1 : 0)));
+  atomic_init(&p->available, count);
+  atomic_init(&p->exhausted, 0);
+  return p;
+}
+
+void *pool_alloc(Pool *p) {
+  uint64_t top = atomic_load(&p->top), next;
+  uint32_t index;
+  do {
+    index = INDEX(top);
+    if (index == 0) {
+      atomic_fetch_add(&p->exhausted, 1);
+      return NULL;
+    }
+    next = TOP(TAG(top) + 1, atomic_load(&p->next[index - 1]));
+  } while (!atomic_compare_exchange_weak(&p->top, &top, next));
+  atomic_fetch_sub(&p->available, 1);
+  return p->slab + (index - 1) * p->elem_size;
+}
+
+void pool_free(Pool *p, void *element) {
+  uint32_t index;
+  uint64_t top, next;
+  if (element == NULL) return;
+  index = ((char *)element - p->slab) / p->elem_size + 1;
+  top = atomic_load(&p->top);
+  do {
+    atomic_store(&p->next[index - 1], INDEX(top));
+    next = TOP(TAG(top) + 1, index);
+  } while (!atomic_compare_exchange_weak(&p->top, &top, next));
+  atomic_fetch_add(&p->available, 1);
+}
+
+int pool_available(Pool *p) {
+  return atomic_load(&p->available);
+}
+
+int pool_size(Pool *p) {
+  return p->count;
+}
+
+uint32_t pool_exhausted(Pool *p) {
+  return atomic_load(&p->exhausted);
+}
+
+void pool_destroy(Pool *p) {
+  free(p->slab);
+  free(p->next);
+  free(p);
+}
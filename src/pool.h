@@ -0,0 +1,17 @@
+#ifndef POOL_H
+#define POOL_H
+#include <stdint.h>
+
+typedef struct pool Pool;
+
+/* Preallocates count elements of elem_size bytes. Allocation and release
+ * are lock-free and may happen on different threads */
+Pool *pool_create(int count, int elem_size);
+void *pool_alloc(Pool *p);
+void pool_free(Pool *p, void *element);
+int pool_available(Pool *p);
+int pool_size(Pool *p);
+uint32_t pool_exhausted(Pool *p); /* Number of failed allocations */
+void pool_destroy(Pool *p);
+
+#endif /* POOL_H */
@@ -0,0 +1,65 @@
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define ELEMENTS 8
+#define THREADS 4
+#define HOLD 3 /* Slots each thread holds at once, more than its share */
+#define ROUNDS 100000
+
+typedef struct slot {
+  int owner;
+  int round;
+} Slot;
+
+Pool *p;
+volatile int failures;
+
+/* Holds a few slots at a time, tagged with who has them, and checks after
+ * a yield that no other thread was handed one of them meanwhile */
+void *worker(void *arg) {
+  Slot *held[HOLD];
+  int id = (int)(long)arg, i, j, n;
+  for (i = 0; i < ROUNDS; i++) {
+    for (n = 0; n < HOLD && (held[n] = pool_alloc(p)) != NULL; n++) {
+      held[n]->owner = id;
+      held[n]->round = i;
+    }
+    sched_yield();
+    for (j = 0; j < n; j++) {
+      if (held[j]->owner != id || held[j]->round != i) {
+        printf("slot %p shared between threads\n", (void *)held[j]);
+        __sync_fetch_and_add(&failures, 1);
+      }
+      pool_free(p, held[j]);
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char const *argv[]) {
+  Slot *slots[ELEMENTS + 1];
+  pthread_t threads[THREADS];
+  int i, j, failed = 0;
+  (void)argc; (void)argv;
+  p = pool_create(ELEMENTS, sizeof(Slot));
+  for (i = 0; i <= ELEMENTS; i++) slots[i] = pool_alloc(p);
+  for (i = 0; i < ELEMENTS; i++) {
+    if (slots[i] == NULL) failed = printf("allocation %d failed\n", i);
+    for (j = 0; j < i; j++)
+      if (slots[i] && slots[i] == slots[j]) failed = printf("slot %d handed out twice\n", i);
+  }
+  if (slots[ELEMENTS] != NULL) failed = printf("allocated past the pool size\n");
+  if (pool_available(p) != 0 || pool_exhausted(p) != 1) failed = printf("wrong counts when empty\n");
+  for (i = 0; i < ELEMENTS; i++) pool_free(p, slots[i]);
+  if (pool_available(p) != ELEMENTS) failed = printf("slots lost on free\n");
+
+  for (i = 0; i < THREADS; i++) pthread_create(&threads[i], NULL, worker, (void *)(long)(i + 1));
+  for (i = 0; i < THREADS; i++) pthread_join(threads[i], NULL);
+  printf("available %d of %d, %d shared\n", pool_available(p), pool_size(p), failures);
+  if (failures || pool_available(p) != pool_size(p)) failed = 1;
+  pool_destroy(p);
+  return failed != 0;
+}
@@ -0,0 +1,156 @@
+/* Runs two reliable streams against each other over an in-process link
+ * that loses frames, standing in for the radio calls rf24reliable.c makes */
+#include "rf24reliable.h"
+#include "nRF24L01.h"
+#include "compatibility.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LINK_DEPTH 64
+#define STREAM_LEN 20000
+#define SLOW_LEN 4000
+#define WINDOW 16
+
+/* One end's inbox, handed to the stream as its RF24Ctx */
+typedef struct link_end {
+  uint8_t addr[ADDR_WIDTH];
+  uint8_t frames[LINK_DEPTH][MAX_PAYLOAD_LEN];
+  uint8_t lens[LINK_DEPTH];
+  uint8_t from[LINK_DEPTH];
+  int head, tail;
+  unsigned seed;
+  int loss; /* Percentage of frames sent from this end that are lost */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} LinkEnd;
+
+LinkEnd ends[2];
+uint8_t data[STREAM_LEN], got[STREAM_LEN];
+volatile int writer_done;
+
+uint8_t rf24_getMaxSendLen(RF24Ctx *ctx) {
+  (void)ctx;
+  return MAX_PAYLOAD_LEN - ADDR_WIDTH;
+}
+
+int rf24_send_noack(RF24Ctx *ctx, uint8_t *addr, const void *buf, uint8_t len) {
+  LinkEnd *src = (LinkEnd *)ctx, *dst = &ends[addr[0] == ends[0].addr[0] ? 0 : 1];
+  int slot;
+  if ((int)(rand_r(&src->seed) % 100) < src->loss) return 1;
+  pthread_mutex_lock(&dst->lock);
+  if (dst->head - dst->tail < LINK_DEPTH) { /* Full, lost as the radio's FIFO would */
+    slot = dst->head++ % LINK_DEPTH;
+    memcpy(dst->frames[slot], buf, len);
+    dst->lens[slot] = len;
+    dst->from[slot] = src->addr[0];
+    pthread_cond_signal(&dst->cond);
+  }
+  pthread_mutex_unlock(&dst->lock);
+  return 1;
+}
+
+uint8_t rf24_recvfrom_timed(RF24Ctx *ctx, void *buf, uint8_t len, uint8_t *from, int timeout_ms) {
+  LinkEnd *end = (LinkEnd *)ctx;
+  struct timespec deadline;
+  uint8_t n = 0;
+  int slot;
+  deadline_after(&deadline, (timeout_ms < 0 ? 60000 : timeout_ms));
+  pthread_mutex_lock(&end->lock);
+  while (end->head == end->tail && timeout_ms != 0 &&
+         pthread_cond_timedwait(&end->cond, &end->lock, &deadline) == 0);
+  if (end->head != end->tail) {
+    slot = end->tail++ % LINK_DEPTH;
+    n = end->lens[slot];
+    memcpy(buf, end->frames[slot], (n < len ? n : len));
+    memset(from, end->from[slot], ADDR_WIDTH);
+  }
+  pthread_mutex_unlock(&end->lock);
+  return n;
+}
+
+void link_reset(int loss) {
+  int i;
+  for (i = 0; i < 2; i++) {
+    ends[i].head = ends[i].tail = 0;
+    ends[i].seed = i + 1;
+    ends[i].loss = loss;
+  }
+}
+
+/* Reads len bytes and keeps answering the writer until it has flushed.
+ * A reader with hold_ms set services the stream without taking anything
+ * for that long, then polls without blocking */
+typedef struct reader_args {
+  RF24Reliable *s;
+  int len;
+  int hold_ms;
+  int got;
+} ReaderArgs;
+
+void *reader(void *arg) {
+  ReaderArgs *r = (ReaderArgs *)arg;
+  uint64_t until = monotonic_ns() + r->hold_ms * 1000000ULL, give_up = until + 10000000000ULL;
+  int n;
+  while (monotonic_ns() < until) {
+    rf24rel_read(r->s, got, 0, 10);
+    microSleep(1000); /* Returns at once while data waits unread */
+  }
+  while (r->got < r->len) {
+    n = rf24rel_read(r->s, got + r->got, r->len - r->got, (r->hold_ms ? 0 : 5000));
+    if (n == 0 && (!r->hold_ms || monotonic_ns() > give_up)) break;
+    r->got += n;
+  }
+  while (!writer_done) rf24rel_read(r->s, got, 0, 10);
+  return NULL;
+}
+
+/* Writes len bytes from a to b over the link, returns 0 if it all arrived intact */
+int transfer(int len, int loss, int hold_ms, RF24ReliableStats *wstats, RF24ReliableStats *rstats) {
+  RF24Reliable *a = rf24rel_create((RF24Ctx *)&ends[0], ends[1].addr, WINDOW);
+  RF24Reliable *b = rf24rel_create((RF24Ctx *)&ends[1], ends[0].addr, WINDOW);
+  ReaderArgs r = {b, len, hold_ms, 0};
+  pthread_t thread;
+  int failed = 0;
+  link_reset(loss);
+  writer_done = 0;
+  memset(got, 0, sizeof(got));
+  pthread_create(&thread, NULL, reader, &r);
+  if (rf24rel_write(a, data, len) != len) failed = printf("write failed\n");
+  else if (rf24rel_flush(a, 10000) != 1) failed = printf("flush failed\n");
+  writer_done = 1;
+  pthread_join(thread, NULL);
+  if (r.got != len || memcmp(data, got, len)) failed = printf("read %d of %d bytes intact\n", r.got, len);
+  rf24rel_getStats(a, wstats);
+  rf24rel_getStats(b, rstats);
+  rf24rel_destroy(a);
+  rf24rel_destroy(b);
+  return failed;
+}
+
+int main(int argc, char const *argv[]) {
+  RF24ReliableStats w, r;
+  int i, loss, failed = 0;
+  (void)argc; (void)argv;
+  for (i = 0; i < 2; i++) {
+    memset(ends[i].addr, i + 1, ADDR_WIDTH);
+    pthread_mutex_init(&ends[i].lock, NULL);
+    pthread_cond_init(&ends[i].cond, NULL);
+  }
+  for (i = 0; i < STREAM_LEN; i++) data[i] = i * 7 + (i >> 8);
+
+  for (loss = 0; loss <= 30; loss += 15) {
+    failed |= transfer(STREAM_LEN, loss, 0, &w, &r);
+    printf("%d%% loss: sent %u retransmits %u fast %u duplicates %u out of order %u\n",
+           loss, w.sent, w.retransmits, w.fast_retransmits, r.duplicates, r.out_of_order);
+  }
+
+  /* A reader that takes nothing for longer than the retransmission timer
+   * backs off over, then polls: the writer waits on its window rather
+   * than sending past it until it gives up */
+  failed |= transfer(SLOW_LEN, 0, 3500, &w, &r);
+  printf("slow reader: probes %u retransmits %u overrun %u\n", w.probes, w.retransmits, r.overrun);
+  if (w.probes == 0 || r.overrun) failed = printf("slow reader not flow controlled\n");
+  return failed != 0;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE /* ppoll() */
 #include <pthread.h>
 #include <stdio.h>
 #include <poll.h>
@@ -5,62 +6,170 @@
 #include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include "rf24.h"
 #include "gpio.h"
 #include "spi.h"
 #include "nRF24L01.h"
+#include "spscring.h"
 #include "tsqueue.h"
+#include "queue.h"
+#include "pool.h"
 #include "compatibility.h"
 #include "rf24Stats.h"
 
 #define SPI_BITS 8
 #define SPI_MODE 0
-#define GPIO_FILE_MAXLEN  32
 #define POLL_TIMEOUT    1000
-#define RDBUF_LEN   5
-#define PACKET_BUFFER_SIZE 15
-#define ISR_PIN 24
-
-#define is_rx_fifo_empty() (read_register(FIFO_STATUS) & RX_EMPTY)
-#define is_tx_fifo_empty() (read_register(FIFO_STATUS) & TX_EMPTY)
-#define enable_radio() gpio_write(enable_pin, GPIO_HIGH)
-#define disable_radio() gpio_write(enable_pin, GPIO_LOW)
-#define rf24_testRPD() rf24_testCarrierDetect()
-#define pipe0_is_set() (pipe0_status & 0x01)
-#define auto_ACK_occurred() (pipe0_status & 0x02)
+#define PACKET_BUFFER_SIZE 15 /* Default RX queue depth, per pipe */
+#define ISR_PIN 24 /* Default IRQ GPIO */
+#define RX_FIFO_DEPTH 3
+#define RX_PIPES (MAX_PIPE_NUM + 1)
+/* Every pipe's queue full, slots waiting for the next drain and a few held as views */
+#define PACKET_POOL_SIZE(_depth) (RX_PIPES * (_depth) + 2 * RX_FIFO_DEPTH)
+#define COMPACT_HDR_LEN 1 /* Sender header with RF24Options.node_id set */
+/* Room for the shorter compact header, see rx_target() */
+#define PACKET_SLOT_SIZE (sizeof(Packet) + MAX_PAYLOAD_LEN - COMPACT_HDR_LEN)
+#define RECV_BATCH_MAX 16
+#define RT_STACK_SIZE (64 * 1024) /* Locked memory would otherwise pin the default 8MB stacks */
+#define MODERATED_IRQS MASK_RX_DR /* Only RX is coalesced, TX completions still interrupt */
+#define RX_GAP_WEIGHT 8 /* EWMA of the gap between packets moves 1/8th per sample */
+#define RADIO_EVENTS (RX_DR | TX_DS | MAX_RT)
+#define TX_QUEUE_SIZE 16 /* Default async TX queue depth */
+#define TX_INFLIGHT_MAX 2 /* Frames loaded in the TX FIFO at once, see complete_tx() */
+#define TX_TIMEOUT_MS 500
+/* Queued requests, those in the FIFO and the worker's pending list between them */
+#define TX_POOL_SIZE(_depth) ((_depth) + TX_INFLIGHT_MAX + 1)
+#define TX_MAX_BYPASS 8 /* Times a send may be passed over for another destination */
+#define ACK_QUEUE_DEPTH 4 /* ACK payloads waiting per pipe */
+#define TX_FIFO_DEPTH 3
+
+#define is_rx_fifo_empty(_ctx) (read_register(_ctx, FIFO_STATUS) & RX_EMPTY)
+#define is_tx_fifo_empty(_ctx) (read_register(_ctx, FIFO_STATUS) & TX_EMPTY)
+#define enable_radio(_ctx) gpio_line_write((_ctx)->ce_line, GPIO_HIGH)
+#define disable_radio(_ctx) gpio_line_write((_ctx)->ce_line, GPIO_LOW)
+#define rf24_testRPD(_ctx) rf24_testCarrierDetect(_ctx)
+#define pipe0_is_set(_ctx) ((_ctx)->pipe0_status & 0x01)
+#define auto_ACK_occurred(_ctx) ((_ctx)->pipe0_status & 0x02)
 
 typedef struct packet {
+  uint64_t timestamp; /* IRQ time in ns, CLOCK_MONOTONIC */
   uint8_t len;
+  uint8_t pipe;
+  uint8_t status; /* Clocked out with R_RX_PAYLOAD, the SPI read lands here on */
   uint8_t from[ADDR_WIDTH];
   uint8_t payload[];
 } Packet;
 
-typedef struct rf24_packet {
-  uint8_t from[ADDR_WIDTH];
-  uint8_t payload[MAX_PAYLOAD_LEN];
-} RF24Payload;
-
-SPIState *spi;
-uint8_t enable_pin; /**< "Chip Enable" pin, activates the RX or TX role, unused on rpi */
-char *spidevice;
-uint32_t spispeed;
-uint8_t chip_select; /**< SPI Chip select */
-bool wide_band; /* 2Mbs data rate in use? */
-bool p_variant; /* False for RF24L01 and TRUE for RF24L01P */
-uint8_t payload_len; /**< Fixed size of payloads */
-bool ack_payload_available; /**< Whether there is an ack payload waiting */
-bool dyn_payloads_set; /**< Whether dynamic payloads are enabled. */ 
-uint8_t ack_payload_length; /**< Dynamic size of pending ack payload. */
-uint8_t pipe0_status;
-uint8_t pipe0_address[5]; /**< Last address set on pipe 0 for reading. */
-uint8_t pipe1_address[5];
-uint8_t pipe234_lsb[3];
-uint8_t transmit_address[5];
-uint8_t addr_width;
-uint8_t listening;
-pthread_t int_thread;
-TSQueue *packets;
-TXRXStats *stats;
+typedef struct tx_request {
+  uint8_t addr[MAX_ADDR_WIDTH];
+  uint8_t len;
+  uint8_t bypassed; /* Times later sends went ahead of this one */
+  rf24_tx_handler done;
+  void *arg;
+  uint8_t frame[MAX_PAYLOAD_LEN]; /* Sender header then payload, see build_frame() */
+} TXRequest;
+
+typedef struct ack_payload {
+  uint8_t len;
+  rf24_tx_handler done;
+  void *arg;
+  uint8_t data[MAX_PAYLOAD_LEN];
+} AckPayload;
+
+/* Everything about one radio, handed out as RF24Ctx */
+struct rf24_ctx {
+  SPIState *spi;
+  uint8_t enable_pin; /**< "Chip Enable" pin, activates the RX or TX role, unused on rpi */
+  GPIOLine *ce_line;
+  char *spidevice;
+  uint32_t spispeed;
+  uint8_t chip_select; /**< SPI Chip select */
+  bool wide_band; /* 2Mbs data rate in use? */
+  bool p_variant; /* False for RF24L01 and TRUE for RF24L01P */
+  uint8_t payload_len; /**< Fixed size of payloads */
+  bool ack_payload_available; /**< Whether there is an ack payload waiting */
+  bool dyn_payloads_set; /**< Whether dynamic payloads are enabled on every pipe, so sends aren't padded */
+  uint8_t dpl_pipes; /**< DYNPD as written, frames on these pipes are only as long as sent */
+  bool dyn_ack_set; /**< Whether EN_DYN_ACK is on, so W_TX_PAYLOAD_NOACK works */
+  uint8_t pipe0_status;
+  uint8_t pipe0_address[5]; /**< Last address set on pipe 0 for reading. */
+  uint8_t pipe1_address[5];
+  uint8_t pipe234_lsb[3];
+  uint8_t transmit_address[5];
+  uint8_t addr_width;
+  uint8_t config_reg; /**< Cached CONFIG register, saves a read on every mode change */
+  uint8_t irq_mask; /**< IRQs masked in CONFIG by interrupt moderation */
+  pthread_mutex_t config_lock; /**< Guards CONFIG against the ISR thread */
+  uint8_t listening;
+  pthread_t int_thread;
+  uint64_t irq_time; /**< When the interrupt being serviced fired */
+  SPSCRing *packets[RX_PIPES]; /**< ISR thread to receiver handoff, one per pipe */
+  volatile uint8_t pipes_claimed; /**< Pipes given to rf24_recv_pipe() by rf24_claimPipe(), skipped by the rest */
+  uint8_t next_pipe; /**< Where the next any-pipe receive starts looking */
+  volatile int rx_any_waiting; /**< A receiver is blocked waiting on any pipe */
+  int rx_any_fd; /**< Wakes it */
+  Pool *packet_pool; /**< Preallocated slots for received packets */
+  Packet *rx_slots[RX_FIFO_DEPTH]; /**< Slots the next drain reads into, ISR thread only */
+  uint32_t rx_no_slot; /**< Packets dropped as no slot was free */
+  rf24_overflow_e rx_overflow; /**< What to do when the RX queue is full */
+  uint32_t rx_dropped; /**< Packets dropped because the RX queue was full */
+  uint32_t rx_stalls; /**< Drains paused to leave packets in the radio FIFO */
+  volatile int rx_stalled; /**< ISR thread waits for the receiver to make room */
+  int rx_kick_fd; /**< Wakes the ISR thread to resume a stalled drain */
+  uint32_t busy_poll_us; /**< How long to spin on STATUS after traffic, 0 for interrupts only */
+  uint16_t busy_poll_budget; /**< Events handled per spin before waiting on the IRQ again */
+  uint32_t rx_irq_wakeups; /**< Interrupts serviced */
+  uint32_t rx_busy_polls; /**< Spins started */
+  uint32_t rx_poll_hits; /**< Events found by spinning rather than by interrupt */
+  uint32_t moderation_max_us; /**< Longest IRQs may stay masked, 0 to never mask */
+  uint64_t rx_gap_ewma; /**< Average gap between received packets, ns */
+  uint64_t rx_last_time; /**< When the last drain read packets */
+  uint32_t rx_moderated; /**< Times IRQs were masked */
+  uint32_t rx_coalesced; /**< Drains done while masked, each an interrupt saved */
+  rf24_rx_handler rx_handler; /**< Called with each packet on the ISR thread instead of queueing */
+  void *rx_handler_arg;
+  TXRXStats *stats;
+  uint8_t irq_pin; /**< GPIO the radio's IRQ line is wired to */
+  uint8_t isr_running; /**< The interrupt thread was started */
+  volatile int closing; /**< Tells the interrupt thread to exit */
+  pthread_mutex_t tx_lock; /**< Held for a whole send, or while the TX worker has frames out */
+  TSQueue *tx_queue; /**< Requests waiting for the TX worker */
+  Pool *tx_pool; /**< Preallocated TX requests */
+  pthread_t tx_thread;
+  uint8_t tx_running; /**< The TX worker was started */
+  pthread_mutex_t tx_event_lock; /**< Guards the fields below */
+  pthread_cond_t tx_cond; /**< Wakes the TX worker */
+  uint8_t tx_events; /**< TX_DS/MAX_RT read and cleared by the ISR thread, RX_DR if an ACK payload came with TX_DS */
+  uint8_t tx_arc; /**< ARC_CNT of the last frame to finish */
+  uint8_t tx_kicked; /**< New requests were queued */
+  uint8_t tx_closing; /**< Tells the TX worker to exit */
+  TXRequest **tx_pending; /**< Taken off tx_queue by the worker, oldest first */
+  int tx_pending_count;
+  uint32_t tx_window_us; /**< Time the worker lets sends gather before starting */
+  uint8_t tx_arrival_addr[MAX_ADDR_WIDTH]; /**< Destination of the last send queued */
+  uint32_t tx_fifo_writes; /**< Address writes sending in queue order would need */
+  uint32_t tx_addr_writes; /**< Address writes the worker made */
+  uint32_t tx_reordered; /**< Sends moved ahead of older ones */
+  uint8_t hdr_len; /**< Sender header length, ADDR_WIDTH or COMPACT_HDR_LEN */
+  uint8_t node_id; /**< Our compact ID, when hdr_len is COMPACT_HDR_LEN */
+  uint8_t peer_known[256 / 8]; /**< Compact IDs with an address below */
+  uint8_t peers[256][ADDR_WIDTH]; /**< Full address for each compact ID */
+  pthread_mutex_t ack_lock; /**< Guards the ACK payload state below */
+  Pool *ack_pool; /**< Preallocated ACK payloads */
+  Queue *ack_queue[RX_PIPES]; /**< ACK payloads waiting to be loaded, per pipe */
+  AckPayload *ack_loaded[RX_PIPES]; /**< In the TX FIFO, goes with the pipe's next ACK */
+  AckPayload *ack_held[RX_PIPES]; /**< Taken out of the TX FIFO for a send, loaded again first */
+  AckPayload *ack_sent[RX_PIPES]; /**< Went with an ACK, delivered once the node sends again */
+  uint8_t ack_loaded_count; /**< TX FIFO slots holding ACK payloads */
+  volatile uint8_t ack_active; /**< ACK payloads have been queued on some pipe */
+  uint8_t ack_pipes; /**< Pipes set up for ACK payloads */
+  uint32_t ack_loaded_at[RX_PIPES]; /**< rx_passes when the loaded payload went in */
+  uint32_t ack_carrier[RX_PIPES]; /**< First drain pass whose frames took the loaded payload, 0 until known */
+  uint32_t rx_passes; /**< RX FIFO drain passes started, see ack_payload_rx() */
+};
+
 /****************************************************************************/
   // Minimum ideal SPI bus speed is 2x data rate
   // If we assume 2Mbs data rate and 16Mhz clock, a
@@ -109,190 +218,217 @@ static const uint8_t pipe_payload_len[] = {
 static const uint8_t pipe_enable[] = {
   ERX_P0, ERX_P1, ERX_P2, ERX_P3, ERX_P4, ERX_P5
 };
-void *radio_isr_thread();
+/* Commands clocked out when draining the RX FIFO */
+static const uint8_t clear_rx_dr[2] = {W_REGISTER | STATUS, RX_DR};
+static const uint8_t read_width[2] = {R_RX_PL_WID, NOP};
+static const uint8_t read_rx_payload[MAX_PAYLOAD_LEN + 1] = {R_RX_PAYLOAD};
+static const uint8_t read_fifo_status[2] = {R_REGISTER | FIFO_STATUS, NOP};
+static const uint8_t read_observe_tx[2] = {R_REGISTER | OBSERVE_TX, NOP};
+void *radio_isr_thread(void *arg);
+void transmit_frame(RF24Ctx *ctx, uint8_t cmd, const void* buf, uint8_t len);
+void enable_dyn_ack(RF24Ctx *ctx);
+void *tx_worker_thread(void *arg);
+uint8_t take_tx_events(RF24Ctx *ctx);
+uint8_t wait_tx_events(RF24Ctx *ctx, int millisec);
+int take_packets_timed(RF24Ctx *ctx, Packet **batch, int max, int timeout_ms);
+void finish_ack_payload(RF24Ctx *ctx, AckPayload *ack, rf24_tx_result_e result);
+void load_ack_payloads(RF24Ctx *ctx);
+void fill_ack_fifo(RF24Ctx *ctx);
+void ack_payload_rx(RF24Ctx *ctx, uint8_t pipe, uint32_t pass);
+void ack_rx_fifo_empty(RF24Ctx *ctx, uint32_t pass);
+void drop_loaded_ack_payloads(RF24Ctx *ctx);
+void unload_ack_payloads(RF24Ctx *ctx);
+void resume_listening(RF24Ctx *ctx);
+uint8_t build_frame(RF24Ctx *ctx, uint8_t *frame, const void* buf, uint8_t len);
+uint8_t *rx_target(RF24Ctx *ctx, Packet *packet);
+void expand_sender(RF24Ctx *ctx, Packet *packet);
+void wake_any_receiver(RF24Ctx *ctx);
+
+/***********************/
+/* SPI frame functions */
+/***********************/
+/* Clocks a command byte and len data bytes through the radio as one SPI
+ * transfer. tx may be NULL to clock out NOPs, rx may be NULL to discard
+ * the response. Returns the STATUS byte shifted out with the command. */
+uint8_t spi_command(RF24Ctx *ctx, uint8_t cmd, const uint8_t *tx, uint8_t *rx, uint8_t len) {
+  uint8_t frame[MAX_PAYLOAD_LEN + 1];
+  frame[0] = cmd;
+  if (tx) memcpy(frame + 1, tx, len);
+  else memset(frame + 1, NOP, len);
+  spi_enable(ctx->spi);
+  spi_transfer_bulk(ctx->spi, frame, frame, len + 1);
+  spi_disable(ctx->spi);
+  if (rx) memcpy(rx, frame + 1, len);
+  return frame[0];
+}
 
 /***********************/
 /* Register functions  */
 /***********************/
-uint8_t read_register_bytes(uint8_t reg, uint8_t* buf, uint8_t len) {
-  uint8_t status;
-  spi_enable(spi);
-  spi_transfer(spi, R_REGISTER | (REGISTER_MASK & reg), &status);
-  while (len--) *buf++ = spi_transfer(spi, 0xff, NULL);
-  spi_disable(spi);
-  return status;
+uint8_t read_register_bytes(RF24Ctx *ctx, uint8_t reg, uint8_t* buf, uint8_t len) {
+  return spi_command(ctx, R_REGISTER | (REGISTER_MASK & reg), NULL, buf, len);
 }
 
-uint8_t read_register(uint8_t reg) {
+uint8_t read_register(RF24Ctx *ctx, uint8_t reg) {
   uint8_t result;
-  spi_enable(spi);
-  spi_transfer(spi, R_REGISTER | (REGISTER_MASK & reg), NULL);
-  spi_transfer(spi, 0xff, &result);
-  spi_disable(spi);
+  spi_command(ctx, R_REGISTER | (REGISTER_MASK & reg), NULL, &result, 1);
   return result;
 }
 
-uint8_t write_register_bytes(uint8_t reg, const uint8_t* buf, uint8_t len) {
+uint8_t write_register_bytes(RF24Ctx *ctx, uint8_t reg, const uint8_t* buf, uint8_t len) {
   /* RPi, x86, nRF25L01(+) are all little-endian so no worry about hton/ntoh*/
-  uint8_t status;
-  spi_enable(spi);
-  spi_transfer(spi, W_REGISTER | (REGISTER_MASK & reg), &status);
-  while (len--) spi_transfer(spi, *buf++, NULL);
-  spi_disable(spi);
-  return status;
+  return spi_command(ctx, W_REGISTER | (REGISTER_MASK & reg), buf, NULL, len);
 }
 
-uint8_t write_register(uint8_t reg, uint8_t value) {
-  uint8_t status;
-  spi_enable(spi);
-  spi_transfer(spi, W_REGISTER | (REGISTER_MASK & reg), &status);
-  spi_transfer(spi, value, NULL);
-  spi_disable(spi);
-  return status;
+uint8_t write_register(RF24Ctx *ctx, uint8_t reg, uint8_t value) {
+  return spi_command(ctx, W_REGISTER | (REGISTER_MASK & reg), &value, NULL, 1);
 }
 
 /***********************/
 /* Payload functions   */
 /***********************/
-uint8_t write_payload(const void* buf, uint8_t len) {
-  uint8_t status;
-  const uint8_t* current = (const uint8_t*)buf;
-  uint8_t data_len = (len < payload_len ? len : payload_len);
-  uint8_t blank_len = (dyn_payloads_set ? 0 : payload_len - data_len);
-  spi_enable(spi); /* Write bytes plus blanks if non-dynamic payloads */
-  spi_transfer(spi, W_TX_PAYLOAD, &status);
-  while (data_len--) spi_transfer(spi, *current++, NULL);
-  while (blank_len--) spi_transfer(spi, 0, NULL);
-  spi_disable(spi);
-  return status;
+/* Copies buf into frame, padding with blanks if non-dynamic payloads.
+ * Returns the number of bytes to clock out */
+uint8_t fill_payload(RF24Ctx *ctx, uint8_t *frame, const void* buf, uint8_t len) {
+  uint8_t data_len = (len < ctx->payload_len ? len : ctx->payload_len);
+  uint8_t blank_len = (ctx->dyn_payloads_set ? 0 : ctx->payload_len - data_len);
+  memcpy(frame, buf, data_len);
+  memset(frame + data_len, 0, blank_len);
+  return data_len + blank_len;
 }
 
-uint8_t read_payload(void* buf, uint8_t buf_len, uint8_t payload_len) {
-  uint8_t status, data_len = payload_len, blank_len = 0;
-  uint8_t* current = (uint8_t*)buf;
-  if (buf_len < payload_len){
-    data_len = buf_len;
-    blank_len = payload_len - buf_len;
-  }
-  spi_enable(spi);
-  spi_transfer(spi, R_RX_PAYLOAD, &status);
-  while (data_len--) spi_transfer(spi, 0xff, current++);
-  while (blank_len--) spi_transfer(spi, 0xff, NULL);
-  spi_disable(spi);
+uint8_t write_payload(RF24Ctx *ctx, const void* buf, uint8_t len) {
+  uint8_t frame[MAX_PAYLOAD_LEN];
+  return spi_command(ctx, W_TX_PAYLOAD, frame, NULL, fill_payload(ctx, frame, buf, len));
+}
+
+uint8_t read_payload(RF24Ctx *ctx, void* buf, uint8_t buf_len, uint8_t payload_len) {
+  uint8_t status, frame[MAX_PAYLOAD_LEN];
+  status = spi_command(ctx, R_RX_PAYLOAD, NULL, frame, payload_len);
+  memcpy(buf, frame, (buf_len < payload_len ? buf_len : payload_len));
   return status;
 }
 
 /***********************/
 /* FIFO functions      */
 /***********************/
-uint8_t flush_rx() {
-  uint8_t status;
-  spi_enable(spi);
-  spi_transfer(spi, FLUSH_RX, &status);
-  spi_disable(spi);
-  return status;
+uint8_t flush_rx(RF24Ctx *ctx) {
+  return spi_command(ctx, FLUSH_RX, NULL, NULL, 0);
 }
 
-uint8_t flush_tx() {
-  uint8_t status;
-  spi_enable(spi);
-  spi_transfer(spi, FLUSH_TX, &status);
-  spi_disable(spi);
+uint8_t flush_tx(RF24Ctx *ctx) {
+  uint8_t status = spi_command(ctx, FLUSH_TX, NULL, NULL, 0);
+  if (ctx->ack_active) drop_loaded_ack_payloads(ctx);
   return status;
 }
 
-uint8_t check_status() {
-  uint8_t status;
-  spi_enable(spi);
-  spi_transfer(spi, NOP, &status);
-  spi_disable(spi);
-  return status;
+uint8_t check_status(RF24Ctx *ctx) {
+  return spi_command(ctx, NOP, NULL, NULL, 0);
 }
 
-void toggle_features() {
-  spi_enable(spi);
-  spi_transfer(spi, ACTIVATE, NULL);
-  spi_transfer(spi, ACTIVATE_2, NULL);
-  spi_disable(spi);
+void toggle_features(RF24Ctx *ctx) {
+  uint8_t activate = ACTIVATE_2;
+  spi_command(ctx, ACTIVATE, &activate, NULL, 1);
 }
 
-uint8_t get_dyn_payload_len() {
-  uint8_t result = 0;
-  spi_enable(spi);
-  spi_transfer(spi, R_RX_PL_WID, NULL);
-  spi_transfer(spi, 0xff, &result);
-  spi_disable(spi);
-  return result;
+/* Writes CONFIG, keeping any IRQ masks interrupt moderation has applied */
+void write_config(RF24Ctx *ctx, uint8_t config) {
+  pthread_mutex_lock(&ctx->config_lock);
+  ctx->config_reg = (config & ~MODERATED_IRQS) | ctx->irq_mask;
+  write_register(ctx, CONFIG, ctx->config_reg);
+  pthread_mutex_unlock(&ctx->config_lock);
+}
+
+void set_irq_mask(RF24Ctx *ctx, uint8_t mask) {
+  pthread_mutex_lock(&ctx->config_lock);
+  ctx->irq_mask = mask;
+  ctx->config_reg = (ctx->config_reg & ~MODERATED_IRQS) | mask;
+  write_register(ctx, CONFIG, ctx->config_reg);
+  pthread_mutex_unlock(&ctx->config_lock);
 }
 
 /* private function for transmitting packet */
-void transmit_payload(const void* buf, uint8_t len) {
-  if (listening) disable_radio();
-  write_register(CONFIG, (read_register(CONFIG) & ~PRIM_RX)); /* Toggle RX/TX mode */
+void transmit_payload(RF24Ctx *ctx, const void* buf, uint8_t len) {
+  transmit_frame(ctx, W_TX_PAYLOAD, buf, len);
+}
+
+/* As transmit_payload, cmd picks W_TX_PAYLOAD or W_TX_PAYLOAD_NOACK */
+void transmit_frame(RF24Ctx *ctx, uint8_t cmd, const void* buf, uint8_t len) {
+  uint8_t config[2] = {W_REGISTER | CONFIG};
+  uint8_t frame[MAX_PAYLOAD_LEN + 1] = {cmd};
+  SPIMessage seq[2] = {
+    {config, NULL, sizeof(config)}, /* Toggle RX/TX mode */
+    {frame, NULL, fill_payload(ctx, frame + 1, buf, len) + 1} /* Write the payload to the TX FIFO */
+  };
+  if (ctx->ack_loaded_count) unload_ack_payloads(ctx);
+  if (ctx->listening) disable_radio(ctx);
+  pthread_mutex_lock(&ctx->config_lock);
+  config[1] = ctx->config_reg = ctx->config_reg & ~PRIM_RX;
+  spi_transfer_seq(ctx->spi, seq, 2);
+  pthread_mutex_unlock(&ctx->config_lock);
   microSleep(TRANSITION_DELAY); /* Let the transition to TX mode settle */
-  write_payload(buf, len); /* Write the payload to the TX FIFO */
-  enable_radio(); /* Pulse radio on CE pin to TX one packet from FIFO */
+  enable_radio(ctx); /* Pulse radio on CE pin to TX one packet from FIFO */
   microSleep(WRITE_DELAY);
-  disable_radio();
+  disable_radio(ctx);
   microSleep(TRANSITION_DELAY); /* Let the transition to Standby mode settle */
-  if (listening) rf24_startListening();
+  if (ctx->listening) resume_listening(ctx);
 }
 
 /*********************/
 /* Address functions */
 /*********************/
-uint8_t *reverse_address(uint8_t *address){
-  uint8_t i = 0, j = addr_width - 1, temp = 0;
-  while (i < j){
-    temp = address[i];
-    address[i++] = address[j];
-    address[j--] = temp;
-  }
-  return address;
+/* Copies address into reversed LSB first, as the address registers take
+ * it. The caller's copy is left alone so cached addresses stay comparable */
+uint8_t *reverse_address(RF24Ctx *ctx, const uint8_t *address, uint8_t *reversed){
+  uint8_t i;
+  for (i = 0; i < ctx->addr_width; i++) reversed[i] = address[ctx->addr_width - 1 - i];
+  return reversed;
 }
 
-uint8_t rf24_setAddressWidth(uint8_t address_width){
+uint8_t rf24_setAddressWidth(RF24Ctx *ctx, uint8_t address_width){
   if (address_width > MAX_ADDR_WIDTH || address_width < MIN_ADDR_WIDTH) return 0;
-  write_register(AW, address_width);
-  addr_width = address_width;
-  return addr_width;
+  write_register(ctx, AW, address_width);
+  ctx->addr_width = address_width;
+  return ctx->addr_width;
 }
 
-uint8_t rf24_getAddressWidth(){
-  return read_register(AW);
+uint8_t rf24_getAddressWidth(RF24Ctx *ctx){
+  return read_register(ctx, AW);
 }
 
-void setTXAddress(uint8_t *addr) {
-  memcpy(transmit_address, addr, addr_width);
-  write_register_bytes(TX_ADDR, reverse_address(transmit_address), addr_width);
+void setTXAddress(RF24Ctx *ctx, uint8_t *addr) {
+  uint8_t reversed[MAX_ADDR_WIDTH];
+  memcpy(ctx->transmit_address, addr, ctx->addr_width);
+  write_register_bytes(ctx, TX_ADDR, reverse_address(ctx, addr, reversed), ctx->addr_width);
 }
 
-void rf24_setRXAddressOnPipe(uint8_t *address, uint8_t pipe) {
+void rf24_setRXAddressOnPipe(RF24Ctx *ctx, uint8_t *address, uint8_t pipe) {
+  uint8_t reversed[MAX_ADDR_WIDTH];
   if (pipe > MAX_PIPE_NUM) return;
   if (pipe == 0){ /* cache pipe0 address as ackWrites overwrite this */
-    pipe0_status = PIPE0_SET;
-    memcpy(pipe0_address, address, addr_width);
+    ctx->pipe0_status = PIPE0_SET;
+    memcpy(ctx->pipe0_address, address, ctx->addr_width);
   } else if (pipe == 1) {
-    memcpy(pipe1_address, address, addr_width);
+    memcpy(ctx->pipe1_address, address, ctx->addr_width);
   } else {
-    memcpy(pipe234_lsb, address, 1);
+    memcpy(ctx->pipe234_lsb, address, 1);
   }
   switch(pipe){ /* For pipes 2-5, only write the last byte */
     case(0):
-    case(1): write_register_bytes(pipe_addr[pipe], reverse_address(address), addr_width); break;
-    default: write_register_bytes(pipe_addr[pipe], address + (addr_width - 1), 1); break;
+    case(1): write_register_bytes(ctx, pipe_addr[pipe], reverse_address(ctx, address, reversed), ctx->addr_width); break;
+    default: write_register_bytes(ctx, pipe_addr[pipe], address + (ctx->addr_width - 1), 1); break;
   }
-  write_register(pipe_payload_len[pipe], payload_len); /* Set payload len and enable */
-  write_register(EN_RXADDR, (read_register(EN_RXADDR) | pipe_enable[pipe]));
+  write_register(ctx, pipe_payload_len[pipe], ctx->payload_len); /* Set payload len and enable */
+  write_register(ctx, EN_RXADDR, (read_register(ctx, EN_RXADDR) | pipe_enable[pipe]));
 }
 
 /***************************/
 /* TX Rate/Power functions */
 /***************************/
 
-void rf24_setDataRate(rf24_datarate_e speed) {
-  uint8_t setup = read_register(RF_SETUP);
-  wide_band = FALSE;
+void rf24_setDataRate(RF24Ctx *ctx, rf24_datarate_e speed) {
+  uint8_t setup = read_register(ctx, RF_SETUP);
+  ctx->wide_band = FALSE;
   setup &= ~RF_DR; /* Clear DR bits i.e. 1Mbps is 00 */
   switch(speed){
     case(RF24_250KBPS): {
@@ -301,17 +437,17 @@ void rf24_setDataRate(rf24_datarate_e speed) {
     }
     case(RF24_1MBPS): break; /* Already set */
     case(RF24_2MBPS): {
-      wide_band = TRUE;
+      ctx->wide_band = TRUE;
       setup |= RF_DR_2M; /* Set high speed bit */
       break;
     }
     case(RF24_ERROR): return;
   }
-  write_register(RF_SETUP, setup);
+  write_register(ctx, RF_SETUP, setup);
 }
 
-rf24_datarate_e rf24_getDataRate() {
-  uint8_t dr = read_register(RF_SETUP) & RF_DR; /* Extract DR bits */
+rf24_datarate_e rf24_getDataRate(RF24Ctx *ctx) {
+  uint8_t dr = read_register(ctx, RF_SETUP) & RF_DR; /* Extract DR bits */
   switch(dr){
     case(RF_DR_250K): return RF24_250KBPS;
     case(RF_DR_1M): return RF24_1MBPS;
@@ -320,8 +456,8 @@ rf24_datarate_e rf24_getDataRate() {
   }
 }
 
-void rf24_setPALevel(rf24_pa_dbm_e level) {
-  uint8_t setup = read_register(RF_SETUP) & ~RF_PWR; /* Clear RF_PWR bits */
+void rf24_setPALevel(RF24Ctx *ctx, rf24_pa_dbm_e level) {
+  uint8_t setup = read_register(ctx, RF_SETUP) & ~RF_PWR; /* Clear RF_PWR bits */
   switch(level){
     case(RF24_PA_MIN): break; /* Already set */
     case(RF24_PA_LOW): setup |= RF_PWR_LOW; break;
@@ -329,11 +465,11 @@ void rf24_setPALevel(rf24_pa_dbm_e level) {
     case(RF24_PA_MAX): /* Fallthrough */
     case(RF24_PA_ERROR): setup |= RF_PWR_MAX; break;
   }
-  write_register(RF_SETUP, setup);
+  write_register(ctx, RF_SETUP, setup);
 }
 
-rf24_pa_dbm_e rf24_getPALevel() {
-  uint8_t power = read_register(RF_SETUP) & RF_PWR; /* Extract RF_PWR bits */
+rf24_pa_dbm_e rf24_getPALevel(RF24Ctx *ctx) {
+  uint8_t power = read_register(ctx, RF_SETUP) & RF_PWR; /* Extract RF_PWR bits */
   switch(power){
     case(RF_PWR_MAX): return RF24_PA_MAX;
     case(RF_PWR_HIGH): return RF24_PA_HIGH;
@@ -346,18 +482,18 @@ rf24_pa_dbm_e rf24_getPALevel() {
 /* CRC Functions */
 /*****************/
 
-void rf24_setCRCLength(rf24_crclength_e length) {
-  uint8_t config = read_register(CONFIG) & ~CRC_BITS; /* Clear CRC bits */
+void rf24_setCRCLength(RF24Ctx *ctx, rf24_crclength_e length) {
+  uint8_t config = read_register(ctx, CONFIG) & ~CRC_BITS; /* Clear CRC bits */
   switch(length){
     case(RF24_CRC_DISABLED): break; /* Already set */
     case(RF24_CRC_8): config |= EN_CRC_8; break; /* Enable 8bit CRC */
     case(RF24_CRC_16): config |= EN_CRC_16; break; /* Enable 16bit CRC */
   }
-  write_register(CONFIG, config);
+  write_config(ctx, config);
 }
 
-rf24_crclength_e rf24_getCRCLength() {
-  uint8_t config = read_register(CONFIG) & CRC_BITS; /* Extract CRC bits */
+rf24_crclength_e rf24_getCRCLength(RF24Ctx *ctx) {
+  uint8_t config = read_register(ctx, CONFIG) & CRC_BITS; /* Extract CRC bits */
   switch(config){
     case(EN_CRC_8): return RF24_CRC_8;
     case(EN_CRC_16): return RF24_CRC_16;
@@ -365,30 +501,31 @@ rf24_crclength_e rf24_getCRCLength() {
   }
 }
 
-bool isPVariant() {
-  return p_variant;
+bool isPVariant(RF24Ctx *ctx) {
+  return ctx->p_variant;
 }
 
-void rf24_setRetries(uint8_t delay, uint8_t count) {
- write_register(SETUP_RETR, (delay&0xf)<<ARD | (count&0xf)<<ARC);
+void rf24_setRetries(RF24Ctx *ctx, uint8_t delay, uint8_t count) {
+ write_register(ctx, SETUP_RETR, (delay&0xf)<<ARD | (count&0xf)<<ARC);
 }
 
-void rf24_setChannel(uint8_t channel) {
+void rf24_setChannel(RF24Ctx *ctx, uint8_t channel) {
   // TODO: This method could take advantage of the 'wide_band' calculation
   // done in setChannel() to require certain channel spacing.
-  write_register(RF_CH, (channel < MAX_CHANNEL ? channel : MAX_CHANNEL));
+  write_register(ctx, RF_CH, (channel < MAX_CHANNEL ? channel : MAX_CHANNEL));
 }
 
-void rf24_setPayloadSize(uint8_t size) {
-  payload_len = (size < MAX_PAYLOAD_LEN ? size : MAX_PAYLOAD_LEN);
+void rf24_setPayloadSize(RF24Ctx *ctx, uint8_t size) {
+  ctx->payload_len = (size < MAX_PAYLOAD_LEN ? size : MAX_PAYLOAD_LEN);
 }
 
-uint8_t rf24_getPayloadSize() {
-  return payload_len;
+uint8_t rf24_getPayloadSize(RF24Ctx *ctx) {
+  return ctx->payload_len;
 }
 
-void setDefaults() {
-  disable_radio();
+void setDefaults(RF24Ctx *ctx) {
+  disable_radio(ctx);
+  ctx->config_reg = read_register(ctx, CONFIG);
 
   // Must allow the radio time to settle else configuration bits will not necessarily stick.
   // This is actually only required following power up but some settling time also appears to
@@ -400,99 +537,243 @@ void setDefaults() {
   // Set 1500uS (minimum for 32B payload in ESB@250KBPS) timeouts, to make testing a little easier
   // WARNING: If this is ever lowered, either 250KBS mode with AA is broken or maximum packet
   // sizes must never be used. See documentation for a more complete explanation.
-  write_register(SETUP_RETR, ARD_1500u | ARC_15);
+  write_register(ctx, SETUP_RETR, ARD_1500u | ARC_15);
 
   // Restore our default PA level
-  rf24_setPALevel(RF24_PA_MAX);
+  rf24_setPALevel(ctx, RF24_PA_MAX);
 
   // Determine if this is a p or non-p RF24 module and then
   // reset our data rate back to default value. This works
   // because a non-P variant won't allow the data rate to
   // be set to 250Kbps.
-  rf24_setDataRate(RF24_250KBPS);
-  if(rf24_getDataRate() == RF24_250KBPS) p_variant = TRUE;
+  rf24_setDataRate(ctx, RF24_250KBPS);
+  if(rf24_getDataRate(ctx) == RF24_250KBPS) ctx->p_variant = TRUE;
   
   // Then set the data rate to the slowest (and most reliable) speed supported by all
   // hardware.
-  rf24_setDataRate(RF24_1MBPS);
+  rf24_setDataRate(ctx, RF24_1MBPS);
 
   // Initialize CRC and request 2-byte (16bit) CRC
-  rf24_setCRCLength(RF24_CRC_16);
+  rf24_setCRCLength(ctx, RF24_CRC_16);
   
   // Disable dynamic payloads, to match dyn_payloads_set setting
-  write_register(DYNPD, 0);
+  write_register(ctx, DYNPD, 0);
+  ctx->dyn_payloads_set = FALSE;
+  ctx->dpl_pipes = 0;
+  ctx->ack_pipes = 0; /* Set up again, DYNPD included, on the next queued payload */
+  ctx->dyn_ack_set = FALSE; /* Checked again on the first NOACK send */
 
   // Reset current status
   // Notice reset and flush is the last thing we do
-  write_register(STATUS, (RX_DR | TX_DS | MAX_RT));
+  write_register(ctx, STATUS, (RX_DR | TX_DS | MAX_RT));
 
   // Set up default configuration.  Callers can always change it later.
   // This channel should be universally safe and not bleed over into adjacent
   // spectrum.
-  rf24_setChannel(76);
+  rf24_setChannel(ctx, 76);
 
   /* Set default address width to 5bytes */
-  rf24_setAddressWidth(5);
+  rf24_setAddressWidth(ctx, 5);
 
   // Flush buffers
-  flush_rx();
-  flush_tx();
-  listening = FALSE;
+  flush_rx(ctx);
+  flush_tx(ctx);
+  ctx->listening = FALSE;
+}
+
+void rf24_defaultOptions(RF24Options *opts) {
+  memset(opts, 0, sizeof(RF24Options));
+  opts->gpio_backend = RF24_GPIO_SYSFS;
+  opts->gpio_chip = "/dev/gpiochip0";
+  opts->irq_pin = ISR_PIN;
+  opts->rx_queue_depth = PACKET_BUFFER_SIZE;
+  opts->rx_overflow = RF24_DROP_NEWEST;
+  opts->node_id = -1;
+  opts->tx_queue_depth = TX_QUEUE_SIZE;
+  opts->cpu = -1;
+}
+
+RF24Ctx *rf24_init_radio(char *spi_device, uint32_t spi_speed, uint8_t cepin) {
+  RF24Options opts;
+  rf24_defaultOptions(&opts);
+  return rf24_init_radio_opts(spi_device, spi_speed, cepin, &opts);
 }
 
-uint8_t rf24_init_radio(char *spi_device, uint32_t spi_speed, uint8_t cepin) {
+RF24Ctx *rf24_init_radio_opts(char *spi_device, uint32_t spi_speed, uint8_t cepin,
+                              const RF24Options *opts) {
+  ThreadOpts thread_opts = {opts->rt_priority, opts->cpu, 0};
+  RF24Ctx *ctx;
+  uint8_t i;
+  if (opts->node_id > 255) return NULL; /* Won't fit the 1-byte header */
+  if ((ctx = (RF24Ctx *)calloc(1, sizeof(RF24Ctx))) == NULL) return NULL;
+  ctx->rx_kick_fd = ctx->rx_any_fd = -1;
+  pthread_mutex_init(&ctx->config_lock, NULL);
+  pthread_mutex_init(&ctx->tx_lock, NULL);
+  pthread_mutex_init(&ctx->tx_event_lock, NULL);
+  pthread_mutex_init(&ctx->ack_lock, NULL);
+  pthread_cond_init(&ctx->tx_cond, NULL);
   // Initialize pins
-  spidevice = spi_device;
-  spispeed = spi_speed;
-  enable_pin = cepin;
-  chip_select = (strncmp(spidevice, "/dev/spidev0.1", 14) ? 8 : 9);
-  gpio_open(enable_pin, GPIO_OUT);
-
-  spi = spi_init(spidevice, SPI_MODE, SPI_BITS, spispeed, chip_select);
-  if (spi == NULL) return 0;
-  setDefaults();
-  stats = stats_create(1);
-  stats_start_monitor(stats);
-  pthread_create(&int_thread, NULL, radio_isr_thread, NULL);
-  packets = tsq_create(PACKET_BUFFER_SIZE);
-  return 1;
+  ctx->spidevice = spi_device;
+  ctx->spispeed = spi_speed;
+  ctx->enable_pin = cepin;
+  ctx->irq_pin = opts->irq_pin;
+  if (!gpio_set_backend((opts->gpio_backend == RF24_GPIO_CDEV ? GPIO_BACKEND_CDEV : GPIO_BACKEND_SYSFS), 
+                        opts->gpio_chip)) goto fail;
+#ifdef RF24_GPIO_CS
+  ctx->chip_select = (strncmp(ctx->spidevice, "/dev/spidev0.1", 14) ? 8 : 9);
+#else
+  ctx->chip_select = SPI_DRIVER_CS; /* spidev drives CE0/CE1 for us */
+#endif
+  ctx->ce_line = gpio_line_open(ctx->enable_pin, GPIO_OUT);
+  if (ctx->ce_line == NULL) goto fail;
+
+  ctx->spi = spi_init(ctx->spidevice, SPI_MODE, SPI_BITS, ctx->spispeed, ctx->chip_select);
+  if (ctx->spi == NULL) goto fail;
+  setDefaults(ctx);
+  /* Lock before allocating, so the pool and rings are faulted in up front */
+  if (opts->lock_memory) {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) perror("mlockall");
+    else thread_opts.stack_size = RT_STACK_SIZE;
+  }
+  ctx->stats = stats_create(1);
+  if (ctx->stats == NULL) goto fail;
+  stats_start_monitor_opts(ctx->stats, &thread_opts);
+  ctx->rx_overflow = opts->rx_overflow;
+  ctx->hdr_len = (opts->node_id >= 0 ? COMPACT_HDR_LEN : ADDR_WIDTH);
+  ctx->node_id = opts->node_id;
+  ctx->rx_kick_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  ctx->rx_any_fd = eventfd(0, EFD_CLOEXEC);
+  ctx->packet_pool = pool_create(PACKET_POOL_SIZE(opts->rx_queue_depth), PACKET_SLOT_SIZE);
+  if (ctx->packet_pool == NULL || ctx->rx_kick_fd < 0 || ctx->rx_any_fd < 0) goto fail;
+  for (i = 0; i < RX_PIPES; i++) {
+    if ((ctx->packets[i] = spsc_create(opts->rx_queue_depth)) == NULL) goto fail;
+  }
+  ctx->tx_queue = tsq_create(opts->tx_queue_depth);
+  ctx->tx_pool = pool_create(TX_POOL_SIZE(opts->tx_queue_depth), sizeof(TXRequest));
+  ctx->tx_pending = (TXRequest **)malloc(TX_POOL_SIZE(opts->tx_queue_depth) * sizeof(TXRequest *));
+  if (ctx->tx_queue == NULL || ctx->tx_pool == NULL || ctx->tx_pending == NULL) goto fail;
+  if ((ctx->ack_pool = pool_create(RX_PIPES * ACK_QUEUE_DEPTH, sizeof(AckPayload))) == NULL) goto fail;
+  for (i = 0; i < RX_PIPES; i++) {
+    if ((ctx->ack_queue[i] = q_create(ACK_QUEUE_DEPTH)) == NULL) goto fail;
+  }
+  ctx->isr_running = thread_create(&ctx->int_thread, &thread_opts, radio_isr_thread, ctx);
+  if (!ctx->isr_running) goto fail;
+  ctx->tx_running = thread_create(&ctx->tx_thread, &thread_opts, tx_worker_thread, ctx);
+  if (!ctx->tx_running) goto fail;
+  return ctx;
+fail:
+  rf24_close(ctx);
+  return NULL;
+}
+
+/* Stops the interrupt thread and frees everything, also used to unwind a
+ * partly initialised context */
+void rf24_close(RF24Ctx *ctx) {
+  uint64_t one = 1;
+  uint8_t i;
+  if (ctx->tx_running) {
+    pthread_mutex_lock(&ctx->tx_event_lock);
+    ctx->tx_closing = 1;
+    pthread_cond_broadcast(&ctx->tx_cond);
+    pthread_mutex_unlock(&ctx->tx_event_lock);
+    pthread_join(ctx->tx_thread, NULL);
+  }
+  if (ctx->isr_running) {
+    ctx->closing = 1;
+    if (write(ctx->rx_kick_fd, &one, sizeof(one)) < 0) perror("rf24_close");
+    pthread_join(ctx->int_thread, NULL);
+  }
+  if (ctx->stats) {
+    stats_stop_monitor(ctx->stats);
+    stats_destroy(ctx->stats);
+  }
+  for (i = 0; i < RX_PIPES; i++) {
+    if (ctx->packets[i]) spsc_destroy(ctx->packets[i]);
+    if (ctx->ack_queue[i] == NULL) continue;
+    finish_ack_payload(ctx, ctx->ack_loaded[i], RF24_TX_CANCELLED);
+    finish_ack_payload(ctx, ctx->ack_held[i], RF24_TX_CANCELLED);
+    finish_ack_payload(ctx, ctx->ack_sent[i], RF24_TX_CANCELLED);
+    while (q_count(ctx->ack_queue[i]))
+      finish_ack_payload(ctx, (AckPayload *)q_remove(ctx->ack_queue[i]), RF24_TX_CANCELLED);
+    q_destroy(ctx->ack_queue[i]);
+  }
+  if (ctx->ack_pool) pool_destroy(ctx->ack_pool);
+  if (ctx->packet_pool) pool_destroy(ctx->packet_pool);
+  if (ctx->tx_queue) tsq_destroy(ctx->tx_queue);
+  if (ctx->tx_pool) pool_destroy(ctx->tx_pool);
+  free(ctx->tx_pending);
+  if (ctx->rx_kick_fd >= 0) close(ctx->rx_kick_fd);
+  if (ctx->rx_any_fd >= 0) close(ctx->rx_any_fd);
+  if (ctx->spi) spi_close(ctx->spi);
+  if (ctx->ce_line) {
+    disable_radio(ctx);
+    gpio_line_close(ctx->ce_line);
+  }
+  pthread_mutex_destroy(&ctx->config_lock);
+  pthread_mutex_destroy(&ctx->tx_lock);
+  pthread_mutex_destroy(&ctx->tx_event_lock);
+  pthread_mutex_destroy(&ctx->ack_lock);
+  pthread_cond_destroy(&ctx->tx_cond);
+  free(ctx);
 }
 
-void rf24_resetcfg(){
-  write_register(CONFIG, RST_CFG);
-  setDefaults();
+void rf24_resetcfg(RF24Ctx *ctx){
+  write_config(ctx, RST_CFG);
+  setDefaults(ctx);
 }
 
-void rf24_startListening() {
-  write_register(CONFIG, (read_register(CONFIG) | PWR_UP | PRIM_RX));
-  write_register(STATUS, (RX_DR | TX_DS | MAX_RT));
+/* Switches to RX, leaving the ACK payload FIFO to the caller */
+void start_listening(RF24Ctx *ctx) {
+  uint8_t config[2] = {W_REGISTER | CONFIG};
+  /* TX_DS/MAX_RT are left for the ISR thread to pass on to the sender */
+  uint8_t status[2] = {W_REGISTER | STATUS, RX_DR};
+  uint8_t pipe0[MAX_ADDR_WIDTH + 1] = {W_REGISTER | RX_ADDR_P0};
+  SPIMessage seq[3] = {
+    {config, NULL, sizeof(config)},
+    {status, NULL, sizeof(status)},
+    {pipe0, NULL, ctx->addr_width + 1}
+  };
   /* If PIPE0's addr has been set and then changed by an autoACK, restore it */
-  if (PIPE0_SET && PIPE0_AUTO_ACKED) 
-    write_register_bytes(RX_ADDR_P0, reverse_address(pipe0_address), addr_width);
-  enable_radio();
+  reverse_address(ctx, ctx->pipe0_address, pipe0 + 1);
+  pthread_mutex_lock(&ctx->config_lock);
+  config[1] = ctx->config_reg = ctx->config_reg | PWR_UP | PRIM_RX;
+  spi_transfer_seq(ctx->spi, seq, (PIPE0_SET && PIPE0_AUTO_ACKED ? 3 : 2));
+  pthread_mutex_unlock(&ctx->config_lock);
+  enable_radio(ctx);
   microSleep(TRANSITION_DELAY); /* wait for the radio to come up */
-  listening = TRUE;
+  ctx->listening = TRUE;
 }
 
-void rf24_stopListening() {
-  disable_radio();
-  flush_tx();
-  flush_rx();
-  listening = FALSE;
+void rf24_startListening(RF24Ctx *ctx) {
+  start_listening(ctx);
+  if (ctx->ack_active) load_ack_payloads(ctx);
 }
 
-void rf24_powerDown() {
-  write_register(CONFIG, (read_register(CONFIG) & ~PWR_UP));
+/* Back to RX at the end of a send, with tx_lock still held */
+void resume_listening(RF24Ctx *ctx) {
+  start_listening(ctx);
+  if (ctx->ack_active) fill_ack_fifo(ctx);
+}
+
+void rf24_stopListening(RF24Ctx *ctx) {
+  disable_radio(ctx);
+  flush_tx(ctx);
+  flush_rx(ctx);
+  ctx->listening = FALSE;
+}
+
+void rf24_powerDown(RF24Ctx *ctx) {
+  write_config(ctx, ctx->config_reg & ~PWR_UP);
   microSleep(POWER_DOWN_DELAY);
 }
 
-void rf24_powerUp() {
-  write_register(CONFIG, (read_register(CONFIG) | PWR_UP));
+void rf24_powerUp(RF24Ctx *ctx) {
+  write_config(ctx, ctx->config_reg | PWR_UP);
   microSleep(POWER_UP_DELAY);
 }
 
-bool rf24_available(uint8_t* pipe_num) {
-  uint8_t status = check_status();
+bool rf24_available(RF24Ctx *ctx, uint8_t* pipe_num) {
+  uint8_t status = check_status(ctx);
   bool result = (status & RX_DR);
   if (result) {
     // If the caller wants the pipe number, include that
@@ -501,158 +782,797 @@ bool rf24_available(uint8_t* pipe_num) {
   return result;
 }
 
-bool rf24_packetAvailable(){
-  return tsq_count(packets) > 0;
+bool rf24_packetAvailable(RF24Ctx *ctx){
+  uint8_t i;
+  for (i = 0; i < RX_PIPES; i++) {
+    if (!(ctx->pipes_claimed & (1 << i)) && spsc_count(ctx->packets[i]) > 0) return TRUE;
+  }
+  return FALSE;
 }
 
-uint8_t rf24_recv(void* buf, uint8_t len, uint8_t block) {
-  Packet * p = tsq_remove(packets, block);
-  if (p == NULL) return 0; /* No packet available (nonblocking) */
-  memcpy(buf, p->payload, (p->len > len ? len : p->len));
-  uint8_t p_len = p->len - ADDR_WIDTH; /* Save len whilst we free the memory */
-  free(p);
+bool rf24_pipePacketAvailable(RF24Ctx *ctx, uint8_t pipe){
+  return pipe < RX_PIPES && spsc_count(ctx->packets[pipe]) > 0;
+}
+
+void rf24_getRXStats(RF24Ctx *ctx, RF24RXStats *rx_stats) {
+  rx_stats->pool_exhausted = ctx->rx_no_slot;
+  rx_stats->queue_dropped = ctx->rx_dropped;
+  rx_stats->backpressure_stalls = ctx->rx_stalls;
+  rx_stats->pool_free = pool_available(ctx->packet_pool);
+  rx_stats->irq_wakeups = ctx->rx_irq_wakeups;
+  rx_stats->busy_polls = ctx->rx_busy_polls;
+  rx_stats->busy_poll_hits = ctx->rx_poll_hits;
+  rx_stats->irq_moderated = ctx->rx_moderated;
+  rx_stats->irq_coalesced = ctx->rx_coalesced;
+}
+
+void rf24_setIRQModeration(RF24Ctx *ctx, uint32_t max_us) {
+  ctx->moderation_max_us = max_us;
+}
+
+void rf24_setBusyPoll(RF24Ctx *ctx, uint32_t spin_us, uint16_t budget) {
+  ctx->busy_poll_budget = (budget ? budget : 1);
+  ctx->busy_poll_us = spin_us;
+}
+
+/* Copies a packet out to the caller and releases its slot.
+ * Returns the payload length */
+uint8_t deliver_packet(RF24Ctx *ctx, Packet *p, void *buf, uint8_t len, uint8_t *from) {
+  uint8_t p_len = p->len - ADDR_WIDTH;
+  memcpy(buf, p->payload, (p_len > len ? len : p_len));
+  if (from) memcpy(from, p->from, ctx->addr_width);
+  pool_free(ctx->packet_pool, p);
   return p_len;
 }
 
-uint8_t rf24_recvfrom(void* buf, uint8_t len, uint8_t *from, uint8_t block) {
-  Packet * p = tsq_remove(packets, block);
+/* Called after taking packets off the RX queue, restarts a drain that
+ * stopped for lack of room */
+void packets_taken(RF24Ctx *ctx) {
+  uint64_t one = 1;
+  if (ctx->rx_stalled && __sync_bool_compare_and_swap(&ctx->rx_stalled, 1, 0)) {
+    if (write(ctx->rx_kick_fd, &one, sizeof(one)) < 0) perror("rx kick");
+  }
+}
+
+/* Takes up to max packets from the next pipe with any queued, round-robin
+ * so a busy pipe can't starve the others */
+int take_any_pipe(RF24Ctx *ctx, Packet **batch, int max) {
+  uint8_t i, pipe;
+  int n;
+  for (i = 0; i < RX_PIPES; i++) {
+    pipe = (ctx->next_pipe + i) % RX_PIPES;
+    if (ctx->pipes_claimed & (1 << pipe)) continue;
+    if ((n = spsc_remove_batch(ctx->packets[pipe], (void **)batch, max, 0)) > 0) {
+      ctx->next_pipe = (pipe + 1) % RX_PIPES;
+      packets_taken(ctx);
+      return n;
+    }
+  }
+  return 0;
+}
+
+/* Receive from any unclaimed pipe, parking on rx_any_fd until the ISR
+ * thread queues something when blocking */
+int take_packets(RF24Ctx *ctx, Packet **batch, int max, uint8_t block) {
+  return take_packets_timed(ctx, batch, max, (block ? -1 : 0));
+}
+
+/* As take_packets, waiting at most timeout_ms, -1 for ever */
+int take_packets_timed(RF24Ctx *ctx, Packet **batch, int max, int timeout_ms) {
+  struct pollfd pfd = {.fd = ctx->rx_any_fd, .events = POLLIN};
+  uint64_t val, deadline = monotonic_ns() + (uint64_t)(timeout_ms > 0 ? timeout_ms : 0) * 1000000ULL, now;
+  int n, ready;
+  for (;;) {
+    if ((n = take_any_pipe(ctx, batch, max)) > 0 || timeout_ms == 0) return n;
+    ctx->rx_any_waiting = 1;
+    __sync_synchronize(); /* Pairs with wake_any_receiver(ctx), recheck after flagging */
+    n = take_any_pipe(ctx, batch, max);
+    if (n == 0 && timeout_ms > 0) {
+      now = monotonic_ns();
+      ready = (now < deadline ? poll(&pfd, 1, (deadline - now + 999999) / 1000000) : 0);
+      if (ready == 0) {
+        ctx->rx_any_waiting = 0;
+        return take_any_pipe(ctx, batch, max);
+      }
+      if (ready < 0) continue; /* Interrupted, wait out what is left */
+    }
+    if (n == 0 && read(ctx->rx_any_fd, &val, sizeof(val)) < 0) continue;
+    ctx->rx_any_waiting = 0;
+    if (n) return n;
+  }
+}
+
+Packet *take_packet(RF24Ctx *ctx, uint8_t block) {
+  Packet *p;
+  return (take_packets(ctx, &p, 1, block) ? p : NULL);
+}
+
+Packet *take_pipe_packet(RF24Ctx *ctx, uint8_t pipe, uint8_t block) {
+  Packet *p = spsc_remove(ctx->packets[pipe], block);
+  if (p) packets_taken(ctx);
+  return p;
+}
+
+bool rf24_recv_view(RF24Ctx *ctx, RF24PacketView *view, uint8_t block) {
+  Packet * p = take_packet(ctx, block);
+  if (p == NULL) return FALSE; /* No packet available (nonblocking) */
+  view->payload = p->payload;
+  view->len = p->len - ADDR_WIDTH;
+  view->from = p->from;
+  view->pipe = p->pipe;
+  view->timestamp = p->timestamp;
+  view->handle = p;
+  return TRUE;
+}
+
+void rf24_release_view(RF24Ctx *ctx, RF24PacketView *view) {
+  if (view->handle == NULL) return; /* Lent to an RX handler, not ours to free */
+  pool_free(ctx->packet_pool, view->handle);
+  view->handle = NULL;
+}
+
+uint8_t rf24_recv(RF24Ctx *ctx, void* buf, uint8_t len, uint8_t block) {
+  Packet * p = take_packet(ctx, block);
   if (p == NULL) return 0; /* No packet available (nonblocking) */
-  memcpy(buf, p->payload, (p->len > len ? len : p->len));
-  memcpy(from, p->from, addr_width);
-  uint8_t p_len = p->len - ADDR_WIDTH; /* Save len whilst we free the memory */
-  free(p);
-  return p_len;
+  return deliver_packet(ctx, p, buf, len, NULL);
+}
+
+uint8_t rf24_recvfrom(RF24Ctx *ctx, void* buf, uint8_t len, uint8_t *from, uint8_t block) {
+  Packet * p = take_packet(ctx, block);
+  if (p == NULL) return 0; /* No packet available (nonblocking) */
+  return deliver_packet(ctx, p, buf, len, from);
+}
+
+uint8_t rf24_recvfrom_timed(RF24Ctx *ctx, void* buf, uint8_t len, uint8_t *from, int timeout_ms) {
+  Packet * p;
+  if (take_packets_timed(ctx, &p, 1, timeout_ms) == 0) return 0; /* Timed out */
+  return deliver_packet(ctx, p, buf, len, from);
+}
+
+uint8_t rf24_recv_any(RF24Ctx *ctx, void* buf, uint8_t len, uint8_t *from, uint8_t *pipe, uint8_t block) {
+  Packet * p = take_packet(ctx, block);
+  if (p == NULL) return 0; /* No packet available (nonblocking) */
+  if (pipe) *pipe = p->pipe;
+  return deliver_packet(ctx, p, buf, len, from);
+}
+
+void rf24_claimPipe(RF24Ctx *ctx, uint8_t pipe) {
+  if (pipe <= MAX_PIPE_NUM) __sync_fetch_and_or(&ctx->pipes_claimed, 1 << pipe);
 }
 
-int rf24_send(uint8_t *addr, const void* buf, uint8_t len) {
-  RF24Payload p;
-  if (len > MAX_PAYLOAD_LEN - ADDR_WIDTH) return 0;
-  memcpy(p.from, pipe1_address, ADDR_WIDTH);
-  memcpy(p.payload, buf, len);
+void rf24_releasePipe(RF24Ctx *ctx, uint8_t pipe) {
+  if (pipe > MAX_PIPE_NUM) return;
+  __sync_fetch_and_and(&ctx->pipes_claimed, ~(1 << pipe));
+  if (spsc_count(ctx->packets[pipe]) > 0) wake_any_receiver(ctx); /* Queued while it was claimed */
+}
+
+uint8_t rf24_recv_pipe(RF24Ctx *ctx, uint8_t pipe, void* buf, uint8_t len, uint8_t *from, uint8_t block) {
+  Packet * p;
+  if (pipe > MAX_PIPE_NUM || !(ctx->pipes_claimed & (1 << pipe))) return 0;
+  p = take_pipe_packet(ctx, pipe, block);
+  if (p == NULL) return 0; /* No packet available (nonblocking) */
+  return deliver_packet(ctx, p, buf, len, from);
+}
+
+int rf24_recv_batch(RF24Ctx *ctx, RF24Message *msgs, int count, uint8_t block) {
+  Packet *batch[RECV_BATCH_MAX];
+  int received = 0, i, n;
+  while (received < count) {
+    n = take_packets(ctx, batch, (count - received < RECV_BATCH_MAX ? count - received : RECV_BATCH_MAX),
+                     (block && received == 0)); /* Only wait for the first */
+    if (n == 0) break;
+    for (i = 0; i < n; i++, received++) {
+      msgs[received].timestamp = batch[i]->timestamp;
+      msgs[received].pipe = batch[i]->pipe;
+      msgs[received].len = deliver_packet(ctx, batch[i], msgs[received].buf, 
+                                          msgs[received].buf_len, msgs[received].from);
+    }
+  }
+  return received;
+}
+
+/* Puts the sender header, our address or compact ID, ahead of the payload */
+uint8_t build_frame(RF24Ctx *ctx, uint8_t *frame, const void* buf, uint8_t len) {
+  if (ctx->hdr_len == COMPACT_HDR_LEN) frame[0] = ctx->node_id;
+  else memcpy(frame, ctx->pipe1_address, ADDR_WIDTH);
+  memcpy(frame + ctx->hdr_len, buf, len);
+  return ctx->hdr_len + len;
+}
+
+uint8_t rf24_getMaxSendLen(RF24Ctx *ctx) {
+  return MAX_PAYLOAD_LEN - ctx->hdr_len;
+}
+
+void rf24_setPeer(RF24Ctx *ctx, uint8_t id, const uint8_t *addr) {
+  memcpy(ctx->peers[id], addr, ADDR_WIDTH);
+  __sync_synchronize(); /* The ISR thread must not see the ID before the address */
+  ctx->peer_known[id / 8] |= 1 << (id % 8);
+}
+
+int rf24_send(RF24Ctx *ctx, uint8_t *addr, const void* buf, uint8_t len) {
+  return rf24_send_flags(ctx, addr, buf, len, 0);
+}
+
+int rf24_send_noack(RF24Ctx *ctx, uint8_t *addr, const void* buf, uint8_t len) {
+  return rf24_send_flags(ctx, addr, buf, len, RF24_NOACK);
+}
+
+int rf24_send_flags(RF24Ctx *ctx, uint8_t *addr, const void* buf, uint8_t len, uint8_t flags) {
+  uint8_t frame[MAX_PAYLOAD_LEN], frame_len;
+  if (len > rf24_getMaxSendLen(ctx)) return 0;
+  frame_len = build_frame(ctx, frame, buf, len);
+  pthread_mutex_lock(&ctx->tx_lock);
+  if ((flags & RF24_NOACK) && !ctx->dyn_ack_set) enable_dyn_ack(ctx);
   /* Check if address already set, saves an SPI call */
-  if (memcmp(addr, transmit_address, addr_width)) setTXAddress(addr);
-  transmit_payload(&p, ADDR_WIDTH + len);
-  stats_increment(stats, len, STATS_TX);
+  if (memcmp(addr, ctx->transmit_address, ctx->addr_width)) setTXAddress(ctx, addr);
+  transmit_frame(ctx, (flags & RF24_NOACK ? W_TX_PAYLOAD_NOACK : W_TX_PAYLOAD), frame, frame_len);
+  pthread_mutex_unlock(&ctx->tx_lock);
+  stats_increment(ctx->stats, len, STATS_TX);
   return 1;
 }
 
-bool rf24_write(const void* buf, uint8_t len) {
+bool rf24_write(RF24Ctx *ctx, const void* buf, uint8_t len) {
   bool result = FALSE;
-  transmit_payload(buf, len);
+  pthread_mutex_lock(&ctx->tx_lock);
+  take_tx_events(ctx); /* Anything left over belongs to an earlier send */
+  transmit_payload(ctx, buf, len);
 
-  uint8_t observe_tx;
   uint8_t status;
   uint32_t sent_at = millis();
   const uint32_t timeout = 500; //ms to wait for timeout
+  /* The ISR thread reads and clears TX_DS/MAX_RT and wakes us, so nothing
+   * touches the SPI bus while we wait */
   do
   {
-    status = read_register_bytes(OBSERVE_TX, &observe_tx, 1);
-    DEBUG_PRINT(printf("%x", observe_tx));
+    status = wait_tx_events(ctx, (int)(timeout - (millis() - sent_at)));
   }
   while(! (status & (TX_DS | MAX_RT)) && (millis() - sent_at < timeout));
+  DEBUG_PRINT(printf("%x", ctx->tx_arc));
+  pthread_mutex_unlock(&ctx->tx_lock);
 
-  bool tx_ok, tx_fail;
-  rf24_getStatus(&tx_ok, &tx_fail, &ack_payload_available);
-  
-  //printf("%u%u%u\r\n", tx_ok, tx_fail, ack_payload_available);
-
-  result = tx_ok;
+  /* STATUS is left to the ISR thread, which has already queued any ACK
+   * payload that came back with TX_DS on pipe 0 */
+  result = (status & TX_DS) != 0;
+  ctx->ack_payload_available = result && (status & RX_DR);
   DEBUG_PRINT(printf("%s\n", result ? "...OK." : "...Failed"));
+  return result;
+}
 
-  // Handle the ack packet
-  if (ack_payload_available) {
-    ack_payload_length = get_dyn_payload_len();
-    DEBUG_PRINT(printf("[AckPacket]/"));
-    DEBUG_PRINT(printf("%i\n", ack_payload_length));
+/**********************/
+/* Asynchronous TX    */
+/**********************/
+/* Takes any TX events the ISR thread has collected */
+uint8_t take_tx_events(RF24Ctx *ctx) {
+  uint8_t events;
+  pthread_mutex_lock(&ctx->tx_event_lock);
+  events = ctx->tx_events;
+  ctx->tx_events = 0;
+  pthread_mutex_unlock(&ctx->tx_event_lock);
+  return events;
+}
+
+int rf24_send_async(RF24Ctx *ctx, uint8_t *addr, const void* buf, uint8_t len,
+                    rf24_tx_handler done, void *arg) {
+  TXRequest *req;
+  if (len > rf24_getMaxSendLen(ctx)) return 0;
+  if ((req = (TXRequest *)pool_alloc(ctx->tx_pool)) == NULL) return 0;
+  memcpy(req->addr, addr, ctx->addr_width);
+  req->len = build_frame(ctx, req->frame, buf, len);
+  req->done = done;
+  req->arg = arg;
+  if (!tsq_add(ctx->tx_queue, req, 0)) { /* Queue full */
+    pool_free(ctx->tx_pool, req);
+    return 0;
   }
-  return result;
+  pthread_mutex_lock(&ctx->tx_event_lock);
+  ctx->tx_kicked = 1;
+  pthread_cond_broadcast(&ctx->tx_cond);
+  pthread_mutex_unlock(&ctx->tx_event_lock);
+  return 1;
+}
+
+uint8_t rf24_getLastARC(RF24Ctx *ctx) {
+  uint8_t arc;
+  pthread_mutex_lock(&ctx->tx_event_lock);
+  arc = ctx->tx_arc;
+  pthread_mutex_unlock(&ctx->tx_event_lock);
+  return arc;
+}
+
+int rf24_txPending(RF24Ctx *ctx) {
+  return pool_size(ctx->tx_pool) - pool_available(ctx->tx_pool);
+}
+
+/* Switches to TX for a run of async sends, CE stays high until it ends.
+ * Returns whether TX_ADDR had to be rewritten */
+uint8_t begin_tx_session(RF24Ctx *ctx, uint8_t *addr) {
+  uint8_t wrote = FALSE;
+  pthread_mutex_lock(&ctx->tx_lock);
+  if (ctx->ack_loaded_count) unload_ack_payloads(ctx);
+  if (ctx->listening) disable_radio(ctx);
+  pthread_mutex_lock(&ctx->config_lock);
+  ctx->config_reg &= ~PRIM_RX;
+  write_register(ctx, CONFIG, ctx->config_reg);
+  pthread_mutex_unlock(&ctx->config_lock);
+  if (memcmp(addr, ctx->transmit_address, ctx->addr_width)) {
+    setTXAddress(ctx, addr);
+    wrote = TRUE;
+  }
+  microSleep(TRANSITION_DELAY); /* Let the transition to TX mode settle */
+  take_tx_events(ctx); /* Anything left over belongs to an earlier send */
+  return wrote;
+}
+
+void end_tx_session(RF24Ctx *ctx) {
+  disable_radio(ctx);
+  if (ctx->listening) resume_listening(ctx);
+  pthread_mutex_unlock(&ctx->tx_lock);
+}
+
+void load_tx_frame(RF24Ctx *ctx, TXRequest *req) {
+  write_payload(ctx, req->frame, req->len);
+  enable_radio(ctx); /* Already high after the first */
+}
+
+/* Reports the oldest count frames as done and shifts the rest down */
+void finish_tx(RF24Ctx *ctx, TXRequest **inflight, uint8_t *n, uint8_t count,
+               rf24_tx_result_e result) {
+  uint8_t i;
+  if (count > *n) count = *n;
+  for (i = 0; i < count; i++) {
+    if (result == RF24_TX_ACKED)
+      stats_increment(ctx->stats, inflight[i]->len - ctx->hdr_len, STATS_TX);
+    if (inflight[i]->done) inflight[i]->done(result, inflight[i]->arg);
+    pool_free(ctx->tx_pool, inflight[i]);
+  }
+  for (i = count; i < *n; i++) inflight[i - count] = inflight[i];
+  *n -= count;
+}
+
+/* Clears MAX_RT after dropping CE. Clearing it with CE high would have the
+ * radio send the failed frame again, reporting on it after the FIFO has
+ * been flushed and reloaded */
+void stop_failed_tx(RF24Ctx *ctx) {
+  pthread_mutex_lock(&ctx->config_lock);
+  if (!(ctx->config_reg & PRIM_RX)) disable_radio(ctx);
+  pthread_mutex_unlock(&ctx->config_lock);
+  write_register(ctx, STATUS, MAX_RT);
+}
+
+/* Works out which frames in the FIFO have finished. TX_DS is one bit, so a
+ * single event may stand for several frames: an empty FIFO says they all
+ * went, otherwise each TX_DS seen (by the ISR thread, then by our own
+ * read-and-clear) is one frame. The FIFO is read before STATUS is cleared
+ * so a frame finishing in between is still counted by the clear. */
+void complete_tx(RF24Ctx *ctx, TXRequest **inflight, uint8_t *n, uint8_t events,
+                 uint8_t timed_out) {
+  static const uint8_t clear_tx[2] = {W_REGISTER | STATUS, TX_DS};
+  uint8_t status[2], fifo[2];
+  uint8_t i, acked;
+  SPIMessage seq[2] = {
+    {read_fifo_status, fifo, sizeof(read_fifo_status)},
+    {clear_tx, status, sizeof(clear_tx)}
+  };
+  spi_transfer_seq(ctx->spi, seq, 2);
+  if (status[0] & MAX_RT) stop_failed_tx(ctx);
+  acked = (events & TX_DS ? 1 : 0) + (status[0] & TX_DS ? 1 : 0);
+  if (fifo[1] & TX_EMPTY) acked = *n;
+  events |= status[0] & (TX_DS | MAX_RT);
+  if (acked) finish_tx(ctx, inflight, n, acked, RF24_TX_ACKED);
+  if (events & MAX_RT) {
+    /* The radio stops on the failed frame, drop it and reload those behind
+     * it. CE is already low, loading raises it again */
+    disable_radio(ctx);
+    finish_tx(ctx, inflight, n, 1, RF24_TX_MAX_RT);
+    flush_tx(ctx);
+    for (i = 0; i < *n; i++) load_tx_frame(ctx, inflight[i]);
+  } else if (timed_out && !acked) {
+    disable_radio(ctx); /* No word from the radio, the IRQ line may not be wired */
+    flush_tx(ctx);
+    finish_tx(ctx, inflight, n, *n, RF24_TX_TIMEOUT);
+  }
+}
+
+/* Moves everything queued onto the worker's pending list, counting the
+ * address writes sending them in queue order would have taken */
+void gather_tx_requests(RF24Ctx *ctx) {
+  TXRequest *req;
+  while ((req = (TXRequest *)tsq_remove(ctx->tx_queue, 0)) != NULL) {
+    req->bypassed = 0;
+    ctx->tx_pending[ctx->tx_pending_count++] = req;
+    if (memcmp(req->addr, ctx->tx_arrival_addr, ctx->addr_width)) {
+      memcpy(ctx->tx_arrival_addr, req->addr, ctx->addr_width);
+      ctx->tx_fifo_writes++;
+    }
+  }
+}
+
+/* Picks the next send, preferring the oldest one to want so TX_ADDR stays
+ * put. Sends to one destination always leave in the order they were
+ * queued, and one passed over TX_MAX_BYPASS times goes next regardless.
+ * With frames in flight only sends to want will do, NULL if there are none */
+TXRequest *pick_tx_request(RF24Ctx *ctx, const uint8_t *want, uint8_t must_match) {
+  TXRequest *req;
+  int i, j;
+  if (ctx->tx_pending_count == 0) return NULL;
+  i = 0;
+  if (want && ctx->tx_pending[0]->bypassed < TX_MAX_BYPASS) {
+    while (i < ctx->tx_pending_count && memcmp(ctx->tx_pending[i]->addr, want, ctx->addr_width)) i++;
+  } else if (want && memcmp(ctx->tx_pending[0]->addr, want, ctx->addr_width)) {
+    i = ctx->tx_pending_count; /* Overdue, nothing else goes before it */
+  }
+  if (i == ctx->tx_pending_count) {
+    if (must_match) return NULL;
+    i = 0;
+  }
+  req = ctx->tx_pending[i];
+  for (j = 0; j < i; j++) ctx->tx_pending[j]->bypassed++;
+  if (i > 0) ctx->tx_reordered++;
+  for (j = i + 1; j < ctx->tx_pending_count; j++) ctx->tx_pending[j - 1] = ctx->tx_pending[j];
+  ctx->tx_pending_count--;
+  return req;
+}
+
+/* Drains the async TX queue, keeping up to TX_INFLIGHT_MAX frames in the
+ * radio's FIFO so the next frame is already loaded when one finishes.
+ * Waiting sends are grouped by destination to save TX_ADDR rewrites, and
+ * as TX_ADDR applies to the whole FIFO a change of destination waits for
+ * it to empty. */
+void *tx_worker_thread(void *arg) {
+  RF24Ctx *ctx = (RF24Ctx *)arg;
+  TXRequest *inflight[TX_INFLIGHT_MAX], *next;
+  uint8_t n = 0, events, session = FALSE, timed_out, last_addr[MAX_ADDR_WIDTH], have_last = FALSE;
+  struct timespec deadline;
+  prefault_stack();
+  for (;;) {
+    gather_tx_requests(ctx);
+    while (n < TX_INFLIGHT_MAX) {
+      next = pick_tx_request(ctx, (n ? inflight[0]->addr : (have_last ? last_addr : NULL)), n > 0);
+      if (next == NULL) break;
+      if (!session) {
+        ctx->tx_addr_writes += begin_tx_session(ctx, next->addr);
+        session = TRUE;
+      } else if (n == 0 && memcmp(next->addr, ctx->transmit_address, ctx->addr_width)) {
+        setTXAddress(ctx, next->addr); /* FIFO is empty, safe to switch */
+        ctx->tx_addr_writes++;
+      }
+      memcpy(last_addr, next->addr, ctx->addr_width);
+      have_last = TRUE;
+      load_tx_frame(ctx, next);
+      inflight[n++] = next;
+    }
+    if (n == 0 && session) {
+      end_tx_session(ctx);
+      session = FALSE;
+    }
+    deadline_after(&deadline, TX_TIMEOUT_MS);
+    timed_out = FALSE;
+    pthread_mutex_lock(&ctx->tx_event_lock);
+    while (!ctx->tx_closing && !(n && ctx->tx_events) &&
+           !(ctx->tx_kicked && n < TX_INFLIGHT_MAX) && !timed_out) {
+      if (n == 0) pthread_cond_wait(&ctx->tx_cond, &ctx->tx_event_lock);
+      else timed_out = pthread_cond_timedwait(&ctx->tx_cond, &ctx->tx_event_lock, &deadline) != 0;
+    }
+    events = (n ? ctx->tx_events : 0);
+    if (n) ctx->tx_events = 0;
+    ctx->tx_kicked = 0;
+    pthread_mutex_unlock(&ctx->tx_event_lock);
+    if (ctx->tx_closing) break;
+    if (n) complete_tx(ctx, inflight, &n, events, timed_out);
+    else if (ctx->tx_window_us && ctx->tx_pending_count == 0)
+      microSleep(ctx->tx_window_us); /* Woken from idle, let a batch build up */
+  }
+  /* Closing, cancel whatever is left */
+  if (n) flush_tx(ctx);
+  finish_tx(ctx, inflight, &n, n, RF24_TX_CANCELLED);
+  gather_tx_requests(ctx);
+  while ((inflight[0] = pick_tx_request(ctx, NULL, FALSE)) != NULL) {
+    n = 1;
+    finish_tx(ctx, inflight, &n, n, RF24_TX_CANCELLED);
+  }
+  if (session) end_tx_session(ctx);
+  return (void *)0;
+}
+
+void rf24_setTXBatchWindow(RF24Ctx *ctx, uint32_t window_us) {
+  ctx->tx_window_us = window_us;
+}
+
+void rf24_getTXStats(RF24Ctx *ctx, RF24TXStats *tx_stats) {
+  tx_stats->addr_writes = ctx->tx_addr_writes;
+  tx_stats->addr_writes_saved = (ctx->tx_fifo_writes > ctx->tx_addr_writes ?
+                                 ctx->tx_fifo_writes - ctx->tx_addr_writes : 0);
+  tx_stats->reordered = ctx->tx_reordered;
+  tx_stats->pending = rf24_txPending(ctx);
+}
+
+/**********************/
+/* Streaming TX       */
+/**********************/
+/* Waits up to millisec for the ISR thread to report TX events */
+uint8_t wait_tx_events(RF24Ctx *ctx, int millisec) {
+  struct timespec deadline;
+  uint8_t events;
+  deadline_after(&deadline, millisec);
+  pthread_mutex_lock(&ctx->tx_event_lock);
+  while (!ctx->tx_events &&
+         pthread_cond_timedwait(&ctx->tx_cond, &ctx->tx_event_lock, &deadline) == 0);
+  events = ctx->tx_events;
+  ctx->tx_events = 0;
+  pthread_mutex_unlock(&ctx->tx_event_lock);
+  return events;
 }
 
-void rf24_getStatus(bool *tx_ok, bool *tx_fail, bool *rx_ready) {
+/* Sends buf as a run of frames with CE held high, topping the TX FIFO back
+ * up each time TX_DS comes in so the radio never idles between frames. The
+ * radio only switches back to RX once the last frame is ACKed, or on the
+ * first MAX_RT/timeout, which abandons the rest of the stream. */
+uint32_t rf24_send_stream(RF24Ctx *ctx, uint8_t *addr, const void* buf, uint32_t len) {
+  const uint8_t *data = (const uint8_t *)buf;
+  uint8_t per_frame = rf24_getMaxSendLen(ctx);
+  uint32_t frames = (len + per_frame - 1) / per_frame, written = 0, acked, i;
+  uint8_t frame[MAX_PAYLOAD_LEN], fifo, events, status, chunk, in_fifo;
+  if (frames == 0) return 0;
+  begin_tx_session(ctx, addr);
+  for (;;) {
+    while (written < frames && !(read_register(ctx, FIFO_STATUS) & TX_FULL)) {
+      chunk = (len - written * per_frame < per_frame ? len - written * per_frame : per_frame);
+      write_payload(ctx, frame, build_frame(ctx, frame, data + written * per_frame, chunk));
+      enable_radio(ctx); /* Already high after the first */
+      written++;
+    }
+    events = wait_tx_events(ctx, TX_TIMEOUT_MS);
+    events |= (status = write_register(ctx, STATUS, TX_DS)) & (TX_DS | MAX_RT);
+    if (status & MAX_RT) stop_failed_tx(ctx);
+    if (events & MAX_RT || !events) break;
+    if (written == frames && (read_register(ctx, FIFO_STATUS) & TX_EMPTY)) break;
+  }
+  /* FIFO_STATUS only tells empty from full, so when the stream is cut short
+   * count one in between as two still queued; what we return is never more
+   * than what was ACKed */
+  fifo = read_register(ctx, FIFO_STATUS);
+  in_fifo = (fifo & TX_EMPTY ? 0 : (fifo & TX_FULL ? 3 : 2));
+  if (in_fifo) flush_tx(ctx);
+  end_tx_session(ctx);
+  acked = written - (in_fifo < written ? in_fifo : written);
+  for (i = 0; i < acked; i++)
+    stats_increment(ctx->stats, (i == frames - 1 ? len - i * per_frame : per_frame), STATS_TX);
+  return (acked == frames ? len : acked * per_frame);
+}
+
+void rf24_getStatus(RF24Ctx *ctx, bool *tx_ok, bool *tx_fail, bool *rx_ready) {
   /* Read the status field and clear the bits in one call*/
-  uint8_t status = write_register(STATUS, (RX_DR | TX_DS | MAX_RT));
+  uint8_t status = write_register(ctx, STATUS, (RX_DR | TX_DS | MAX_RT));
   if (tx_ok) *tx_ok = status & TX_DS;
   if (tx_fail) *tx_fail = status & MAX_RT;
   if (rx_ready) *rx_ready = status & RX_DR;
 }
 
-void rf24_peekStatus(bool *tx_ok, bool *tx_fail, bool *rx_ready) {
-  uint8_t status = check_status();
+void rf24_peekStatus(RF24Ctx *ctx, bool *tx_ok, bool *tx_fail, bool *rx_ready) {
+  uint8_t status = check_status(ctx);
   if (tx_ok) *tx_ok = status & TX_DS;
   if (tx_fail) *tx_fail = status & MAX_RT;
   if (rx_ready) *rx_ready = status & RX_DR;
 }
 
-void rf24_autoACKPacket(){
-    write_register_bytes(RX_ADDR_P0, reverse_address(transmit_address), addr_width);
-    write_register(RX_PW_P0, (payload_len < MAX_PAYLOAD_LEN ? payload_len : MAX_PAYLOAD_LEN));
-    pipe0_status |= PIPE0_AUTO_ACKED;
+void rf24_autoACKPacket(RF24Ctx *ctx){
+    uint8_t reversed[MAX_ADDR_WIDTH];
+    write_register_bytes(ctx, RX_ADDR_P0, reverse_address(ctx, ctx->transmit_address, reversed), ctx->addr_width);
+    write_register(ctx, RX_PW_P0, (ctx->payload_len < MAX_PAYLOAD_LEN ? ctx->payload_len : MAX_PAYLOAD_LEN));
+    ctx->pipe0_status |= PIPE0_AUTO_ACKED;
 }
 
-void rf24_enableDynamicPayloads() {
+void rf24_enableDynamicPayloads(RF24Ctx *ctx) {
   /* Enable dynamic payload feature */
-  uint8_t status = read_register(FEATURE);
+  uint8_t status = read_register(ctx, FEATURE);
   if ((status & EN_DPL) == 0){
-    write_register(FEATURE, (status | EN_DPL));
+    write_register(ctx, FEATURE, (status | EN_DPL));
     printf("Enabling dyn payloads\n");
-    if (read_register(FEATURE) == 0) { /* Did it fail? */
-      toggle_features(); /* Features aren't enabled, enable them and try again */
-      write_register(FEATURE, EN_DPL);
+    if (read_register(ctx, FEATURE) == 0) { /* Did it fail? */
+      toggle_features(ctx); /* Features aren't enabled, enable them and try again */
+      write_register(ctx, FEATURE, EN_DPL);
+    }
+  } /* Already enabled */
+  write_register(ctx, DYNPD, DPL_ALL); /* Enable dynamic payloads on all pipes */
+  ctx->dyn_payloads_set = TRUE;
+  ctx->dpl_pipes = DPL_ALL;
+  ctx->payload_len = 32;
+}
+
+/* Lets frames be sent with W_TX_PAYLOAD_NOACK, see rf24_send_noack() */
+void enable_dyn_ack(RF24Ctx *ctx) {
+  uint8_t status = read_register(ctx, FEATURE);
+  if ((status & EN_DYN_ACK) == 0){
+    write_register(ctx, FEATURE, (status | EN_DYN_ACK));
+    if (read_register(ctx, FEATURE) == 0) { /* Did it fail? */
+      toggle_features(ctx); /* Features aren't enabled, enable them and try again */
+      write_register(ctx, FEATURE, EN_DYN_ACK);
     }
   } /* Already enabled */
-  write_register(DYNPD, DPL_ALL); /* Enable dynamic payloads on all pipes */
-  dyn_payloads_set = TRUE;
-  payload_len = 32;
+  ctx->dyn_ack_set = TRUE;
 }
 
-void rf24_enableAckPayload() {
+void rf24_enableAckPayload(RF24Ctx *ctx) {
   /* enable ack payload and dynamic payload features */
-  uint8_t status = read_register(FEATURE);
-  if ((status & (EN_ACK_PAY | EN_DPL)) == 0){
-    write_register(FEATURE, (status | EN_ACK_PAY | EN_DPL));
+  uint8_t status = read_register(ctx, FEATURE);
+  /* Either may already be on, e.g. EN_DPL after rf24_enableDynamicPayloads() */
+  if ((status & (EN_ACK_PAY | EN_DPL)) != (EN_ACK_PAY | EN_DPL)){
+    write_register(ctx, FEATURE, (status | EN_ACK_PAY | EN_DPL));
     /* If it didn't work, the features are not enabled */
-    if (read_register(FEATURE) == 0) {
-      toggle_features(); /* So enable them and try again */
-      write_register(FEATURE, (EN_ACK_PAY | EN_DPL));
+    if (read_register(ctx, FEATURE) == 0) {
+      toggle_features(ctx); /* So enable them and try again */
+      write_register(ctx, FEATURE, (status | EN_ACK_PAY | EN_DPL));
     }
   }
-  DEBUG_PRINT(printf("FEATURE=%i\r\n", read_register(FEATURE)));
+  DEBUG_PRINT(printf("FEATURE=%i\r\n", read_register(ctx, FEATURE)));
   /* Enable dynamic payload on pipes 0 */
-  write_register(DYNPD, (read_register(DYNPD) | DPL_P0));
+  ctx->dpl_pipes |= DPL_P0;
+  write_register(ctx, DYNPD, ctx->dpl_pipes);
 }
 
-void rf24_writeAckPayload(uint8_t pipe, const void* buf, uint8_t len) {
-  const uint8_t* current = (const uint8_t*)buf;
+void rf24_writeAckPayload(RF24Ctx *ctx, uint8_t pipe, const void* buf, uint8_t len) {
   uint8_t data_len = (len < MAX_PAYLOAD_LEN ? len : MAX_PAYLOAD_LEN);
-  spi_enable(spi);
-  spi_transfer(spi, W_ACK_PAYLOAD | (pipe & 0b111), NULL);
-  while (data_len--) spi_transfer(spi, *current++, NULL);
-  spi_disable(spi);
+  spi_command(ctx, W_ACK_PAYLOAD | (pipe & 0b111), buf, NULL, data_len);
+}
+
+/*************************/
+/* ACK payload queues    */
+/*************************/
+void finish_ack_payload(RF24Ctx *ctx, AckPayload *ack, rf24_tx_result_e result) {
+  if (ack == NULL) return;
+  if (ack->done) ack->done(result, ack->arg);
+  pool_free(ctx->ack_pool, ack);
+}
+
+/* Tops the TX FIFO up with waiting ACK payloads, one per pipe at a time so
+ * each delivery can be pinned to the frame that carried it. Only in RX,
+ * with tx_lock held, as a send would take them for its own frames.
+ *
+ * Frames already in the RX FIFO were ACKed before the payload went in, so
+ * it only goes with frames read by a later drain pass. If the RX FIFO was
+ * empty once the payload was written that is the next pass; otherwise
+ * which of the waiting frames came before it is unknown, and it goes with
+ * none of them until a pass has found the FIFO empty, see ack_rx_fifo_empty() */
+void fill_ack_fifo(RF24Ctx *ctx) {
+  AckPayload *ack;
+  uint8_t pipe, fifo;
+  if (!(ctx->config_reg & PRIM_RX)) return;
+  pthread_mutex_lock(&ctx->ack_lock);
+  for (pipe = 0; pipe < RX_PIPES && ctx->ack_loaded_count < TX_FIFO_DEPTH; pipe++) {
+    if (ctx->ack_loaded[pipe] || (!ctx->ack_held[pipe] && q_count(ctx->ack_queue[pipe]) == 0)) continue;
+    if (read_register(ctx, FIFO_STATUS) & TX_FULL) break;
+    ack = (ctx->ack_held[pipe] ? ctx->ack_held[pipe] : (AckPayload *)q_remove(ctx->ack_queue[pipe]));
+    ctx->ack_held[pipe] = NULL;
+    spi_command(ctx, W_ACK_PAYLOAD | pipe, ack->data, NULL, ack->len);
+    fifo = read_register(ctx, FIFO_STATUS);
+    /* Read after the SPI bus has ordered us against the drain's own reads */
+    ctx->ack_loaded_at[pipe] = ctx->rx_passes;
+    ctx->ack_carrier[pipe] = (fifo & RX_EMPTY ? ctx->rx_passes + 1 : 0);
+    ctx->ack_loaded[pipe] = ack;
+    ctx->ack_loaded_count++;
+  }
+  pthread_mutex_unlock(&ctx->ack_lock);
+}
+
+/* fill_ack_fifo() unless a send is under way, which reloads them itself
+ * once it is back in RX */
+void load_ack_payloads(RF24Ctx *ctx) {
+  if (pthread_mutex_trylock(&ctx->tx_lock) != 0) return;
+  fill_ack_fifo(ctx);
+  pthread_mutex_unlock(&ctx->tx_lock);
+}
+
+/* Takes loaded ACK payloads back out of the TX FIFO before a send, which
+ * would otherwise transmit them to TX_ADDR as data. They are held to go
+ * back in first, ahead of their queues, when the radio returns to RX. One
+ * whose ACK went out just before is sent again */
+void unload_ack_payloads(RF24Ctx *ctx) {
+  uint8_t pipe;
+  spi_command(ctx, FLUSH_TX, NULL, NULL, 0);
+  pthread_mutex_lock(&ctx->ack_lock);
+  for (pipe = 0; pipe < RX_PIPES; pipe++) {
+    if (ctx->ack_loaded[pipe] == NULL) continue;
+    ctx->ack_held[pipe] = ctx->ack_loaded[pipe];
+    ctx->ack_loaded[pipe] = NULL;
+  }
+  ctx->ack_loaded_count = 0;
+  pthread_mutex_unlock(&ctx->ack_lock);
+}
+
+/* The TX FIFO was flushed, taking any loaded ACK payloads with it */
+void drop_loaded_ack_payloads(RF24Ctx *ctx) {
+  AckPayload *dropped[RX_PIPES];
+  uint8_t pipe;
+  pthread_mutex_lock(&ctx->ack_lock);
+  for (pipe = 0; pipe < RX_PIPES; pipe++) {
+    dropped[pipe] = ctx->ack_loaded[pipe];
+    ctx->ack_loaded[pipe] = NULL;
+  }
+  ctx->ack_loaded_count = 0;
+  pthread_mutex_unlock(&ctx->ack_lock);
+  for (pipe = 0; pipe < RX_PIPES; pipe++) finish_ack_payload(ctx, dropped[pipe], RF24_TX_CANCELLED);
+}
+
+/* A frame read by drain pass came in on pipe. The payload sent with an
+ * earlier ACK has arrived, as the node has moved on to a new frame. The
+ * loaded one has gone out with this frame's ACK if the frame is known to
+ * have come after it, see fill_ack_fifo() */
+void ack_payload_rx(RF24Ctx *ctx, uint8_t pipe, uint32_t pass) {
+  AckPayload *delivered;
+  pthread_mutex_lock(&ctx->ack_lock);
+  delivered = ctx->ack_sent[pipe];
+  ctx->ack_sent[pipe] = NULL;
+  if (ctx->ack_loaded[pipe] && ctx->ack_carrier[pipe] && pass >= ctx->ack_carrier[pipe]) {
+    ctx->ack_sent[pipe] = ctx->ack_loaded[pipe];
+    ctx->ack_loaded[pipe] = NULL;
+    ctx->ack_loaded_count--;
+  }
+  pthread_mutex_unlock(&ctx->ack_lock);
+  finish_ack_payload(ctx, delivered, RF24_TX_ACKED);
+}
+
+/* Drain pass found the RX FIFO empty, so every frame that was waiting when
+ * a payload was loaded before it started has now been read */
+void ack_rx_fifo_empty(RF24Ctx *ctx, uint32_t pass) {
+  uint8_t pipe;
+  pthread_mutex_lock(&ctx->ack_lock);
+  for (pipe = 0; pipe < RX_PIPES; pipe++) {
+    if (ctx->ack_loaded[pipe] && !ctx->ack_carrier[pipe] && pass > ctx->ack_loaded_at[pipe])
+      ctx->ack_carrier[pipe] = pass + 1;
+  }
+  pthread_mutex_unlock(&ctx->ack_lock);
+}
+
+int rf24_queueAckPayload(RF24Ctx *ctx, uint8_t pipe, const void* buf, uint8_t len,
+                         rf24_tx_handler done, void *arg) {
+  AckPayload *ack;
+  if (pipe > MAX_PIPE_NUM || len == 0 || len > MAX_PAYLOAD_LEN) return 0;
+  if ((ack = (AckPayload *)pool_alloc(ctx->ack_pool)) == NULL) return 0;
+  memcpy(ack->data, buf, len);
+  ack->len = len;
+  ack->done = done;
+  ack->arg = arg;
+  pthread_mutex_lock(&ctx->ack_lock);
+  if (!(ctx->ack_pipes & (1 << pipe))) {
+    rf24_enableAckPayload(ctx);
+    ctx->dpl_pipes |= 1 << pipe;
+    write_register(ctx, DYNPD, ctx->dpl_pipes);
+    ctx->ack_pipes |= 1 << pipe;
+  }
+  if (!q_add(ctx->ack_queue[pipe], ack)) {
+    pthread_mutex_unlock(&ctx->ack_lock);
+    pool_free(ctx->ack_pool, ack);
+    return 0;
+  }
+  ctx->ack_active = TRUE;
+  pthread_mutex_unlock(&ctx->ack_lock);
+  load_ack_payloads(ctx); /* Straight in if the FIFO has room */
+  return 1;
 }
 
-bool rf24_isAckPayloadAvailable() {
-  bool result = ack_payload_available;
-  ack_payload_available = FALSE;
+bool rf24_isAckPayloadAvailable(RF24Ctx *ctx) {
+  bool result = ctx->ack_payload_available;
+  ctx->ack_payload_available = FALSE;
   return result;
 }
 
-void rf24_setAutoAckOnAll(bool enable) {
-  if (enable) write_register(EN_AA, ENAA_ALL);
-  else write_register(EN_AA, ENAA_NONE);
+void rf24_setAutoAckOnAll(RF24Ctx *ctx, bool enable) {
+  if (enable) write_register(ctx, EN_AA, ENAA_ALL);
+  else write_register(ctx, EN_AA, ENAA_NONE);
 }
 
-void rf24_setAutoAckOnPipe(uint8_t pipe, bool enable) {
+void rf24_setAutoAckOnPipe(RF24Ctx *ctx, uint8_t pipe, bool enable) {
   if (pipe > 5) return;
-  uint8_t en_aa = read_register(EN_AA);
+  uint8_t en_aa = read_register(ctx, EN_AA);
   switch(enable){
     case(TRUE): en_aa |= (1 << pipe); break;
     case(FALSE): en_aa &= (1 << pipe); break;
   }
-  write_register(EN_AA, en_aa);
+  write_register(ctx, EN_AA, en_aa);
 }
 
-bool rf24_testCarrierDetect() {
-  return (read_register(CD) & CD_CMD);
+bool rf24_testCarrierDetect(RF24Ctx *ctx) {
+  return (read_register(ctx, CD) & CD_CMD);
 }
 
 void print_status(uint8_t status) {
@@ -674,16 +1594,16 @@ void print_observe_tx(uint8_t value) {
          );
 }
 
-void print_byte_register(char* name, uint8_t reg) {
+void print_byte_register(RF24Ctx *ctx, char* name, uint8_t reg) {
   printf("\t%s =", name);
-  printf(" 0x%x", read_register(reg++));
+  printf(" 0x%x", read_register(ctx, reg++));
 }
 
-void print_address_register(char* name, uint8_t reg, uint8_t qty) {
+void print_address_register(RF24Ctx *ctx, char* name, uint8_t reg, uint8_t qty) {
   printf("\t%s =", name);
   while (qty--) {
     uint8_t buffer[5];
-    read_register_bytes(reg++, buffer, sizeof(buffer));
+    read_register_bytes(ctx, reg++, buffer, sizeof(buffer));
     printf(" 0x");
     uint8_t* bufptr = buffer + sizeof(buffer);
     while(--bufptr >= buffer) printf("%02x", *bufptr);
@@ -691,94 +1611,352 @@ void print_address_register(char* name, uint8_t reg, uint8_t qty) {
   printf("\r\n");
 }
 
-void rf24_printDetails() {
-  printf("SPI device\t = %s\r\n", spidevice);
-  printf("SPI speed\t = %d\r\n", spispeed);
-  printf("CE GPIO\t = %d\r\n", enable_pin);
-  printf("Data Rate\t = %s\r\n", rf24_datarate_e_str_P[rf24_getDataRate()]);
-  printf("Model\t\t = %s\r\n", rf24_model_e_str_P[isPVariant()]);
-  printf("CRC Length\t = %s\r\n", rf24_crclength_e_str_P[rf24_getCRCLength()]);
-  printf("PA Power\t = %s\r\n", rf24_pa_dbm_e_str_P[rf24_getPALevel()]);
-  print_status(check_status());
-  print_address_register("RX_ADDR_P0-1", RX_ADDR_P0, 2);
-  print_byte_register("RX_ADDR_P2-5", RX_ADDR_P2);
-  //print_address_register("TX_ADDR", TX_ADDR);
-  print_byte_register("RX_PW_P0-6", RX_PW_P0);
-  print_byte_register("EN_AA", EN_AA);
-  print_byte_register("EN_RXADDR", EN_RXADDR);
-  print_byte_register("RF_CH", RF_CH);
-  print_byte_register("RF_SETUP", RF_SETUP);
-  print_byte_register("CONFIG", CONFIG);
-  print_byte_register("DYNPD/FEATURE", DYNPD);
-}
-
-int setup_isr_thread(int pin) {
-  char gpio_file[GPIO_FILE_MAXLEN];
-  gpio_open(pin, GPIO_IN);
-  gpio_enable_edge(pin, GPIO_FALLING_EDGE);
-  memset(gpio_file, 0x00, GPIO_FILE_MAXLEN);
-  snprintf(gpio_file, GPIO_FILE_MAXLEN - 1, "/sys/class/gpio/gpio%d/value", pin);
-  return open(gpio_file, O_RDONLY);
-}
-
-void retrieve_packets(){
-  uint8_t payload_len;
+void rf24_printDetails(RF24Ctx *ctx) {
+  printf("SPI device\t = %s\r\n", ctx->spidevice);
+  printf("SPI speed\t = %d\r\n", ctx->spispeed);
+  printf("CE GPIO\t = %d\r\n", ctx->enable_pin);
+  printf("IRQ GPIO\t = %d\r\n", ctx->irq_pin);
+  printf("Data Rate\t = %s\r\n", rf24_datarate_e_str_P[rf24_getDataRate(ctx)]);
+  printf("Model\t\t = %s\r\n", rf24_model_e_str_P[isPVariant(ctx)]);
+  printf("CRC Length\t = %s\r\n", rf24_crclength_e_str_P[rf24_getCRCLength(ctx)]);
+  printf("PA Power\t = %s\r\n", rf24_pa_dbm_e_str_P[rf24_getPALevel(ctx)]);
+  print_status(check_status(ctx));
+  print_address_register(ctx, "RX_ADDR_P0-1", RX_ADDR_P0, 2);
+  print_byte_register(ctx, "RX_ADDR_P2-5", RX_ADDR_P2);
+  //print_address_register(ctx, "TX_ADDR", TX_ADDR);
+  print_byte_register(ctx, "RX_PW_P0-6", RX_PW_P0);
+  print_byte_register(ctx, "EN_AA", EN_AA);
+  print_byte_register(ctx, "EN_RXADDR", EN_RXADDR);
+  print_byte_register(ctx, "RF_CH", RF_CH);
+  print_byte_register(ctx, "RF_SETUP", RF_SETUP);
+  print_byte_register(ctx, "CONFIG", CONFIG);
+  print_byte_register(ctx, "DYNPD/FEATURE", DYNPD);
+}
+
+GPIOLine *setup_isr_thread(int pin) {
+  GPIOLine *line = gpio_line_open(pin, GPIO_IN);
+  if (line == NULL) return NULL;
+  gpio_line_enable_edge(line, GPIO_FALLING_EDGE);
+  return line;
+}
+
+void rf24_set_rx_handler(RF24Ctx *ctx, rf24_rx_handler handler, void *arg) {
+  ctx->rx_handler_arg = arg;
+  __sync_synchronize(); /* The ISR thread must never see the handler with an old arg */
+  ctx->rx_handler = handler;
+}
+
+/* Where R_RX_PAYLOAD lands in a slot. A compact header is read in
+ * ADDR_WIDTH - 1 bytes further on, so the payload still starts at
+ * packet->payload and the ID is the last byte of packet->from */
+uint8_t *rx_target(RF24Ctx *ctx, Packet *packet) {
+  return &packet->status + ADDR_WIDTH - ctx->hdr_len;
+}
+
+/* Swaps a compact ID for the sender's full address. Unknown IDs come out
+ * as an all-zero address ending in the ID */
+void expand_sender(RF24Ctx *ctx, Packet *packet) {
+  uint8_t id = packet->from[ADDR_WIDTH - 1];
+  if (ctx->peer_known[id / 8] & (1 << (id % 8))) {
+    memcpy(packet->from, ctx->peers[id], ADDR_WIDTH);
+  } else {
+    memset(packet->from, 0, ADDR_WIDTH - 1);
+  }
+}
+
+/* Hands a packet straight to the RX handler, the slot is reused afterwards */
+void dispatch_packet(RF24Ctx *ctx, rf24_rx_handler handler, Packet *packet) {
+  RF24PacketView view = {
+    .payload = packet->payload,
+    .len = packet->len - ADDR_WIDTH,
+    .from = packet->from,
+    .pipe = packet->pipe,
+    .timestamp = packet->timestamp,
+    .handle = NULL
+  };
+  handler(&view, ctx->rx_handler_arg);
+}
+
+/* Wakes a receiver blocked on any pipe, after a drain queued packets */
+void wake_any_receiver(RF24Ctx *ctx) {
+  uint64_t one = 1;
+  __sync_synchronize();
+  if (ctx->rx_any_waiting && __sync_bool_compare_and_swap(&ctx->rx_any_waiting, 1, 0)) {
+    if (write(ctx->rx_any_fd, &one, sizeof(one)) < 0) perror("rx wake");
+  }
+}
+
+/* Queues a received packet on its pipe's queue, applying the overflow
+ * policy if that queue is full. Returns whether it was queued */
+uint8_t queue_packet(RF24Ctx *ctx, Packet *packet) {
+  SPSCRing *queue = ctx->packets[packet->pipe];
+  Packet *oldest;
+  if (spsc_add(queue, packet)) return 1;
+  ctx->rx_dropped++;
+  if (ctx->rx_overflow == RF24_DROP_OLDEST && (oldest = spsc_evict(queue)) != NULL) {
+    pool_free(ctx->packet_pool, oldest);
+    if (spsc_add(queue, packet)) return 1;
+  }
+  pool_free(ctx->packet_pool, packet);
+  return 0;
+}
+
+/* Room left in the fullest pipe queue, the pipe of the packets still in
+ * the radio's FIFO isn't known until they are read */
+int queue_room(RF24Ctx *ctx) {
+  int room = RX_FIFO_DEPTH, left, i;
+  for (i = 0; i < RX_PIPES; i++) {
+    left = spsc_size(ctx->packets[i]) - spsc_count(ctx->packets[i]);
+    if (left < room) room = left;
+  }
+  return room;
+}
+
+/* How many FIFO slots the next drain may read. Under back-pressure this is
+ * limited to the room left in the queue, and when there is none the drain
+ * stalls until the receiver takes a packet */
+uint8_t drain_limit(RF24Ctx *ctx) {
+  int room;
+  if (ctx->rx_overflow != RF24_BACKPRESSURE || ctx->rx_handler) return RX_FIFO_DEPTH;
+  if ((room = queue_room(ctx)) > 0) return room;
+  ctx->rx_stalled = 1;
+  __sync_synchronize(); /* Pairs with packets_taken(ctx), recheck after flagging */
+  room = queue_room(ctx);
+  if (room > 0 && __sync_bool_compare_and_swap(&ctx->rx_stalled, 1, 0)) return room;
+  ctx->rx_stalls++;
+  return 0;
+}
+
+/* Tracks the packet rate for interrupt moderation. Gaps are capped so an
+ * idle spell doesn't take a whole burst to average out */
+void note_rx_rate(RF24Ctx *ctx, uint8_t count) {
+  uint64_t gap, cap = 4000ULL * ctx->moderation_max_us;
+  if (ctx->rx_last_time && ctx->irq_time > ctx->rx_last_time) {
+    gap = (ctx->irq_time - ctx->rx_last_time) / count;
+    if (gap > cap) gap = cap;
+    ctx->rx_gap_ewma += ((int64_t)gap - (int64_t)ctx->rx_gap_ewma) / RX_GAP_WEIGHT;
+  }
+  ctx->rx_last_time = ctx->irq_time;
+}
+
+/* How long to leave IRQs masked for, or 0 when packets arrive too slowly
+ * to be worth it. The wait covers RX_FIFO_DEPTH - 1 packets at the current
+ * rate, leaving a FIFO slot spare so a slightly early packet isn't lost */
+uint32_t coalesce_delay(RF24Ctx *ctx) {
+  uint64_t delay = ctx->rx_gap_ewma * (RX_FIFO_DEPTH - 1) / 1000;
+  if (ctx->moderation_max_us == 0 || delay == 0 || delay > ctx->moderation_max_us) return 0;
+  return delay;
+}
+
+/* Drains the RX FIFO. Each pass clears RX_DR, reads the width and payload
+ * of every FIFO slot and then FIFO_STATUS as a single SPI sequence; slots
+ * beyond the last packet report an RX_P_NO of empty and are ignored.
+ * Payloads are read straight into packet slots, which are handed on as is. */
+void retrieve_packets(RF24Ctx *ctx){
+  uint8_t fifo[2];
+  uint8_t width[RX_FIFO_DEPTH][2];
+  uint8_t scratch[MAX_PAYLOAD_LEN + 1]; /* Sink for payloads with no free slot */
+  SPIMessage seq[2 * RX_FIFO_DEPTH + 2];
+  uint8_t i, n, slots, payload_len, pipe, queued, got;
+  uint32_t pass;
   Packet *packet;
-  while (!is_rx_fifo_empty()){
-    payload_len = (dyn_payloads_set ? get_dyn_payload_len() : MAX_PAYLOAD_LEN);
-    if (payload_len > MAX_PAYLOAD_LEN){
-      flush_rx(); /* Invalid payload needs flushing */
-      continue;
+  rf24_rx_handler handler;
+  do {
+    if ((slots = drain_limit(ctx)) == 0) {
+      /* Leave them in the radio for now, but release the IRQ line for TX events */
+      spi_command(ctx, W_REGISTER | STATUS, &clear_rx_dr[1], NULL, 1);
+      return;
+    }
+    /* Clear the status bit before reading so a packet landing mid-drain re-raises it */
+    pass = ++ctx->rx_passes; /* Before the reads, see fill_ack_fifo() */
+    n = 0;
+    seq[n++] = (SPIMessage){clear_rx_dr, NULL, sizeof(clear_rx_dr)};
+    for (i = 0; i < slots; i++) {
+      if (ctx->rx_slots[i] == NULL) ctx->rx_slots[i] = (Packet*)pool_alloc(ctx->packet_pool);
+      seq[n++] = (SPIMessage){read_width, width[i], sizeof(read_width)};
+      seq[n++] = (SPIMessage){read_rx_payload, (ctx->rx_slots[i] ? rx_target(ctx, ctx->rx_slots[i]) : scratch),
+                              sizeof(read_rx_payload)};
+    }
+    seq[n++] = (SPIMessage){read_fifo_status, fifo, sizeof(read_fifo_status)};
+    if (!spi_transfer_seq(ctx->spi, seq, n)) return;
+    queued = got = 0;
+    for (i = 0; i < slots; i++) {
+      if ((width[i][0] & RX_P_NO) == RX_P_NO) break; /* No more payloads */
+      if ((pipe = (width[i][0] & RX_P_NO) >> 1) > MAX_PIPE_NUM) continue;
+      payload_len = (ctx->dpl_pipes & (1 << pipe) ? width[i][1] : MAX_PAYLOAD_LEN);
+      if (payload_len > MAX_PAYLOAD_LEN){
+        flush_rx(ctx); /* Invalid payload needs flushing */
+        break;
+      }
+      /* Dropped or not, the frame was ACKed */
+      if (ctx->ack_active) ack_payload_rx(ctx, pipe, pass);
+      if (payload_len < ctx->hdr_len) continue; /* Too short to carry a sender */
+      packet = ctx->rx_slots[i];
+      if (packet == NULL) {
+        ctx->rx_no_slot++;
+        continue;
+      }
+      packet->timestamp = ctx->irq_time;
+      if (ctx->hdr_len == COMPACT_HDR_LEN) expand_sender(ctx, packet);
+      packet->len = payload_len + ADDR_WIDTH - ctx->hdr_len; /* As if the full address was sent */
+      packet->pipe = pipe;
+      stats_increment(ctx->stats, payload_len - ctx->hdr_len, STATS_RX);
+      got++;
+      if ((handler = ctx->rx_handler) != NULL) {
+        dispatch_packet(ctx, handler, packet); /* Slot stays put for the next drain */
+        continue;
+      }
+      ctx->rx_slots[i] = NULL;
+      queued |= queue_packet(ctx, packet);
+    }
+    if (ctx->ack_active) {
+      if (fifo[1] & RX_EMPTY) ack_rx_fifo_empty(ctx, pass);
+      load_ack_payloads(ctx);
     }
-    packet = (Packet*)malloc(sizeof(Packet) + (payload_len - ADDR_WIDTH));
-    if (packet == NULL) return; /* Failing silently, probably need to tell someone about this */ 
-    packet->len = payload_len;
-    read_payload(packet->from, payload_len, payload_len); /* Fetch the payload */
-    tsq_add(packets, packet, 0); /* Don't block, if the q is full it's dropped */
-    stats_increment(stats, payload_len - ADDR_WIDTH, STATS_RX);
+    if (queued) wake_any_receiver(ctx);
+    if (got) note_rx_rate(ctx, got);
+  } while (!(fifo[1] & RX_EMPTY));
+}
+
+/* Reads and clears TX_DS in one SPI frame, so each completion is seen by
+ * exactly one reader, and passes it on to whoever is sending along with
+ * the retransmit count of the frame that finished. MAX_RT is cleared
+ * separately, once CE is low. irq_status is the STATUS that raised the
+ * event, its RX_DR may already have been drained */
+void tx_event(RF24Ctx *ctx, uint8_t irq_status) {
+  static const uint8_t clear_tx[2] = {W_REGISTER | STATUS, TX_DS};
+  uint8_t status[2], observe[2], events;
+  SPIMessage seq[2] = {
+    {clear_tx, status, sizeof(clear_tx)},
+    {read_observe_tx, observe, sizeof(read_observe_tx)}
+  };
+  spi_transfer_seq(ctx->spi, seq, 2);
+  if ((events = status[0] & (TX_DS | MAX_RT)) == 0) return;
+  if (events & MAX_RT) stop_failed_tx(ctx);
+  if (events & TX_DS) events |= (irq_status | status[0]) & RX_DR; /* An ACK payload came back */
+  pthread_mutex_lock(&ctx->tx_event_lock);
+  ctx->tx_events |= events;
+  ctx->tx_arc = observe[1] & ARC_CNT;
+  pthread_cond_broadcast(&ctx->tx_cond);
+  pthread_mutex_unlock(&ctx->tx_event_lock);
+}
+
+void process_radio_interrupt(RF24Ctx *ctx, uint8_t status) {
+  if (status & RX_DR) retrieve_packets(ctx);
+  if (status & (TX_DS | MAX_RT)) tx_event(ctx, status);
+}
+
+/* After an interrupt, spins reading STATUS in case more traffic follows,
+ * which saves the interrupt and wake up for each packet of a burst. Every
+ * event found pushes the deadline back out; the spin ends once the radio
+ * has been quiet for busy_poll_us, after busy_poll_budget events so the
+ * receiver's kicks still get serviced, or when the drain stalls */
+void busy_poll(RF24Ctx *ctx, GPIOLine *isr_line, struct pollfd *irq_pfd) {
+  uint64_t now = monotonic_ns(), deadline = now + ctx->busy_poll_us * 1000ULL;
+  uint16_t handled = 0;
+  uint8_t status;
+  ctx->rx_busy_polls++;
+  while (handled < ctx->busy_poll_budget && now < deadline && !ctx->rx_stalled) {
+    status = check_status(ctx);
+    now = monotonic_ns();
+    if (!(status & RADIO_EVENTS)) continue;
+    ctx->irq_time = now;
+    process_radio_interrupt(ctx, status);
+    ctx->rx_poll_hits++;
+    handled++;
+    deadline = now + ctx->busy_poll_us * 1000ULL;
+  }
+  /* The events handled above still raised edges, drop them, then catch
+   * anything that arrived in between as it won't raise another */
+  while (poll(irq_pfd, 1, 0) > 0 && gpio_line_read_event(isr_line, NULL));
+  status = check_status(ctx);
+  if (status & RADIO_EVENTS) {
+    ctx->irq_time = monotonic_ns();
+    process_radio_interrupt(ctx, status);
+    ctx->rx_poll_hits++;
   }
-  /* Clear status bit if there are no more payloads */
-  write_register(STATUS, RX_DR);
 }
 
-void process_radio_interrupt() {
-  bool tx_ok, tx_fail, pkt_avail;
-  rf24_peekStatus(&tx_ok, &tx_fail, &pkt_avail);
-  if (pkt_avail) retrieve_packets();
-  if (tx_ok) {
-    printf(">> TX successful\n");
-    write_register(STATUS, TX_DS);
+/* Waits delay_us between moderated drains. RX_DR is masked, so any edge
+ * seen meanwhile is a TX completion and is passed on straight away rather
+ * than held until the next drain */
+void moderated_wait(RF24Ctx *ctx, GPIOLine *isr_line, struct pollfd *irq_pfd, uint32_t delay_us) {
+  uint64_t now = monotonic_ns(), deadline = now + delay_us * 1000ULL;
+  struct timespec left;
+  uint8_t status;
+  for (; now < deadline; now = monotonic_ns()) {
+    left.tv_sec = (deadline - now) / 1000000000ULL;
+    left.tv_nsec = (deadline - now) % 1000000000ULL;
+    if (ppoll(irq_pfd, 1, &left, NULL) <= 0) continue;
+    if (!gpio_line_read_event(isr_line, NULL)) continue;
+    if ((status = check_status(ctx)) & (TX_DS | MAX_RT)) tx_event(ctx, status);
   }
 }
 
-void *radio_isr_thread() {
-  int fd, result;
-  struct pollfd pfd;
-  char rdbuf[RDBUF_LEN];
-  fd = setup_isr_thread(ISR_PIN);
-  if (fd < 0) {
+/* Interrupt moderation, for when packets arrive fast enough that each
+ * interrupt would bring just one. RX_DR is masked in CONFIG and the
+ * thread waits a few packets' time before draining, until a wait finds
+ * nothing or the rate drops. Unmasking with RX_DR still set asserts the
+ * IRQ again, so nothing is missed on the way out */
+void moderate_interrupts(RF24Ctx *ctx, GPIOLine *isr_line, struct pollfd *irq_pfd) {
+  uint32_t delay;
+  uint8_t status;
+  set_irq_mask(ctx, MODERATED_IRQS);
+  ctx->rx_moderated++;
+  process_radio_interrupt(ctx, check_status(ctx));
+  while ((delay = coalesce_delay(ctx)) != 0 && !ctx->rx_stalled) {
+    moderated_wait(ctx, isr_line, irq_pfd, delay);
+    status = check_status(ctx);
+    if (!(status & RADIO_EVENTS)) break; /* Went quiet */
+    ctx->irq_time = monotonic_ns();
+    process_radio_interrupt(ctx, status);
+    ctx->rx_coalesced++;
+  }
+  set_irq_mask(ctx, 0);
+}
+
+void *radio_isr_thread(void *arg) {
+  RF24Ctx *ctx = (RF24Ctx *)arg;
+  int result;
+  uint64_t kicks;
+  struct pollfd pfd[2];
+  GPIOLine *isr_line;
+  prefault_stack();
+  isr_line = setup_isr_thread(ctx->irq_pin);
+  if (isr_line == NULL) {
     perror("gpio_file");
     return (void *)-1;
   }
-  pfd.fd = fd;
-  pfd.events = POLLPRI;
-
-  while(1) {
-    memset(rdbuf, 0x00, RDBUF_LEN);
-    lseek(fd, 0, SEEK_SET);
-    result = poll(&pfd, 1, -1);
+  pfd[0].fd = gpio_line_fd(isr_line);
+  pfd[0].events = gpio_line_events(isr_line);
+  pfd[1].fd = ctx->rx_kick_fd;
+  pfd[1].events = POLLIN;
+
+  while(!ctx->closing) {
+    result = poll(pfd, 2, -1);
+    if (ctx->closing) break;
     if (result < 0) {
       perror("poll()");
-      close(fd);
+      gpio_line_close(isr_line);
       return (void *)3;
     }
-    result = read(fd, rdbuf, RDBUF_LEN);
-    if (result < 0) {
+    if (pfd[1].revents & POLLIN) { /* The receiver made room */
+      if (read(ctx->rx_kick_fd, &kicks, sizeof(kicks)) == sizeof(kicks)) retrieve_packets(ctx);
+    }
+    if (!(pfd[0].revents & pfd[0].events)) continue;
+    if (!gpio_line_read_event(isr_line, &ctx->irq_time)) {
       perror("read()");
+      gpio_line_close(isr_line);
       return (void *)4;
     }
-    process_radio_interrupt();
+    ctx->rx_irq_wakeups++;
+    if (coalesce_delay(ctx)) {
+      moderate_interrupts(ctx, isr_line, &pfd[0]);
+      continue;
+    }
+    process_radio_interrupt(ctx, check_status(ctx));
+    if (ctx->busy_poll_us) busy_poll(ctx, isr_line, &pfd[0]);
   }
-  close(fd);
+  gpio_line_close(isr_line);
   return (void *)0;
-}
\ No newline at end of file
+}
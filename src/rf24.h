@@ -50,6 +50,124 @@ typedef enum { RF24_1MBPS = 0, RF24_2MBPS, RF24_250KBPS, RF24_ERROR} rf24_datara
  */
 typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e;
 
+/**
+ * GPIO interface.  How the CE and IRQ pins are driven.
+ *
+ * For use with RF24Options
+ */
+typedef enum { RF24_GPIO_SYSFS = 0, RF24_GPIO_CDEV } rf24_gpio_backend_e;
+
+/**
+ * RX queue overflow policy.  What happens to packets arriving when the
+ * receive queue is full.
+ *
+ * For use with RF24Options
+ */
+typedef enum { RF24_DROP_NEWEST = 0, RF24_DROP_OLDEST, RF24_BACKPRESSURE } rf24_overflow_e;
+
+/**
+ * Options fixed when the radio is initialised
+ *
+ * Fill in with rf24_defaultOptions() before changing individual fields.
+ */
+typedef struct rf24_options {
+  rf24_gpio_backend_e gpio_backend; /**< Interface for the CE and IRQ pins, the same for every radio */
+  char *gpio_chip; /**< Character device for RF24_GPIO_CDEV, e.g. "/dev/gpiochip0", the same for every radio */
+  uint8_t irq_pin; /**< GPIO the radio's IRQ line is wired to */
+  uint16_t rx_queue_depth; /**< Packets buffered per pipe between the radio and the receiver */
+  rf24_overflow_e rx_overflow; /**< RF24_BACKPRESSURE leaves packets in the radio's FIFO */
+  int rt_priority; /**< SCHED_FIFO priority for the radio threads, 0 for normal scheduling */
+  int cpu; /**< Core to pin the radio threads to, -1 for any */
+  uint8_t lock_memory; /**< mlockall() so buffers and stacks never page fault */
+  uint16_t tx_queue_depth; /**< Sends rf24_send_async() may have waiting */
+  int16_t node_id; /**< Send this 1-byte ID (0-255) instead of our address, -1 for the full address */
+} RF24Options;
+
+/**
+ * Receive path counters
+ *
+ * For use with rf24_getRXStats()
+ */
+typedef struct rf24_rx_stats {
+  uint32_t pool_exhausted; /**< Packets dropped because no packet slot was free */
+  uint32_t pool_free; /**< Packet slots not currently holding a packet */
+  uint32_t queue_dropped; /**< Packets dropped (newest or oldest) as the queue was full */
+  uint32_t backpressure_stalls; /**< Times the radio's FIFO was left to fill up */
+  uint32_t irq_wakeups; /**< Interrupts serviced */
+  uint32_t busy_polls; /**< Times the interrupt thread started busy-polling */
+  uint32_t busy_poll_hits; /**< Radio events found while busy-polling */
+  uint32_t irq_moderated; /**< Times interrupts were masked to coalesce packets */
+  uint32_t irq_coalesced; /**< Drains done with interrupts masked, each a wake up saved */
+} RF24RXStats;
+
+/**
+ * One received packet's buffer and metadata
+ *
+ * For use with rf24_recv_batch()
+ */
+typedef struct rf24_message {
+  void *buf; /**< Where the payload should be written */
+  uint8_t buf_len; /**< Size of buf */
+  uint8_t len; /**< [out] Length of payload received */
+  uint8_t from[ADDR_WIDTH]; /**< [out] Address of the sender */
+  uint8_t pipe; /**< [out] Pipe the packet arrived on */
+  uint64_t timestamp; /**< [out] When the radio interrupt fired, ns on CLOCK_MONOTONIC */
+} RF24Message;
+
+/**
+ * Read-only view of a received packet, still held in the driver's buffer
+ *
+ * For use with rf24_recv_view()
+ */
+typedef struct rf24_packet_view {
+  const uint8_t *payload; /**< Payload, valid until released */
+  uint8_t len; /**< Length of payload */
+  const uint8_t *from; /**< Address of the sender, ADDR_WIDTH bytes */
+  uint8_t pipe; /**< Pipe the packet arrived on */
+  uint64_t timestamp; /**< When the radio interrupt fired, ns on CLOCK_MONOTONIC */
+  void *handle; /**< Internal, identifies the buffer to release */
+} RF24PacketView;
+
+/**
+ * One radio's state, returned by rf24_init_radio() and passed to every
+ * other call.  Radios with their own contexts run independently, e.g. one
+ * on /dev/spidev0.0 and another on /dev/spidev0.1, each with its own CE
+ * and IRQ pins.
+ */
+typedef struct rf24_ctx RF24Ctx;
+
+/**
+ * Receive callback, see rf24_set_rx_handler()
+ */
+typedef void (*rf24_rx_handler)(const RF24PacketView *view, void *arg);
+
+/* Flags for rf24_send_flags() */
+#define RF24_NOACK 0x01 /* Send once, without waiting for an ACK */
+
+/**
+ * Asynchronous send counters
+ *
+ * For use with rf24_getTXStats()
+ */
+typedef struct rf24_tx_stats {
+  uint32_t addr_writes; /**< TX_ADDR rewrites made by the TX thread */
+  uint32_t addr_writes_saved; /**< Rewrites avoided by grouping sends by destination */
+  uint32_t reordered; /**< Sends moved ahead of older ones to another destination */
+  uint32_t pending; /**< Sends not yet completed */
+} RF24TXStats;
+
+/**
+ * Outcome of an asynchronous send
+ *
+ * For use with rf24_send_async()
+ */
+typedef enum { RF24_TX_ACKED = 0, RF24_TX_MAX_RT, RF24_TX_TIMEOUT, RF24_TX_CANCELLED } rf24_tx_result_e;
+
+/**
+ * Send completion callback, see rf24_send_async()
+ */
+typedef void (*rf24_tx_handler)(rf24_tx_result_e result, void *arg);
+
 /**
  * Driver for nRF24L01(+) 2.4GHz Wireless Transceiver
  */
@@ -58,15 +176,37 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    * Begin operation of the chip
    *
    * Call this in setup(), before calling any other methods.
+   *
+   * @return The radio's context, NULL on failure
+   */
+  RF24Ctx *rf24_init_radio(char *spi_device, uint32_t spi_speed, uint8_t cepin);
+
+  /**
+   * Begin operation of the chip with non-default options
+   *
+   * @see rf24_defaultOptions()
+   */
+  RF24Ctx *rf24_init_radio_opts(char *spi_device, uint32_t spi_speed, uint8_t cepin,
+                                const RF24Options *opts);
+
+  /**
+   * Stop the radio's interrupt thread and free its context
+   *
+   * No other thread may be using the context, e.g. blocked in a receive.
    */
-  uint8_t rf24_init_radio(char *spi_device, uint32_t spi_speed, uint8_t cepin);
+  void rf24_close(RF24Ctx *ctx);
+
+  /**
+   * Fill in the options used by rf24_init_radio()
+   */
+  void rf24_defaultOptions(RF24Options *opts);
 
  /**
    * Reset confguration of the chip
    *
    * Call this to reset all registers
    */
-  void rf24_resetcfg();
+  void rf24_resetcfg(RF24Ctx *ctx);
 
   /**
    * Start listening on the pipes opened for reading.
@@ -75,14 +215,14 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    * in this mode, without first calling stopListening().  Call
    * isAvailable() to check for incoming traffic, and read() to get it.
    */
-  void rf24_startListening();
+  void rf24_startListening(RF24Ctx *ctx);
 
   /**
    * Stop listening for incoming messages
    *
    * Do this before calling write().
    */
-  void rf24_stopListening();
+  void rf24_stopListening(RF24Ctx *ctx);
 
   /**
    * Write to the open writing pipe
@@ -102,17 +242,58 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    * @param len Number of bytes to be sent
    * @return True if the payload was delivered successfully false if not
    */
-  bool rf24_write( const void* buf, uint8_t len );
+  bool rf24_write(RF24Ctx *ctx, const void* buf, uint8_t len);
 
   /**
    * Test whether there are bytes available to be read
    *
    * @return True if there is a payload available on the radio, false if none is
    */
-  bool rf24_available();
+  bool rf24_available(RF24Ctx *ctx, uint8_t* pipe_num);
 
   /* Check whether there is a packet available in the packet buffer */
-  bool rf24_packetAvailable();
+  bool rf24_packetAvailable(RF24Ctx *ctx);
+
+  /* Check whether there is a packet available from the given pipe */
+  bool rf24_pipePacketAvailable(RF24Ctx *ctx, uint8_t pipe);
+
+  /**
+   * Fetch the receive path counters
+   *
+   * @param[out] rx_stats Filled in with a snapshot of the counters
+   */
+  void rf24_getRXStats(RF24Ctx *ctx, RF24RXStats *rx_stats);
+
+  /**
+   * Busy-poll the radio for a while after traffic arrives
+   *
+   * After each interrupt the interrupt thread keeps reading STATUS over
+   * SPI until the radio has been quiet for spin_us, handling any further
+   * packets without waiting for their interrupts.  This cuts latency for
+   * bursts at the cost of a busy CPU during the spin.  Off by default.
+   *
+   * @param spin_us How long to keep polling after the last event, 0 to
+   * use interrupts only
+   * @param budget Most events handled in one spin before going back to
+   * waiting on the interrupt
+   */
+  void rf24_setBusyPoll(RF24Ctx *ctx, uint32_t spin_us, uint16_t budget);
+
+  /**
+   * Coalesce receive interrupts under load
+   *
+   * When packets arrive quickly, the RX_DR interrupt is masked in CONFIG
+   * and the interrupt thread drains the FIFO every few packets' time
+   * instead, unmasking once the FIFO is found empty.  The wait adapts to
+   * the measured packet rate and is kept short enough that the radio's 3
+   * packet FIFO can't overflow.  Moderation only starts when a wait of at
+   * most max_us would gather more than one packet.  TX completions are not
+   * moderated and still wake senders as soon as they interrupt.
+   *
+   * @param max_us Longest interrupts may stay masked between drains, 0 to
+   * disable (the default)
+   */
+  void rf24_setIRQModeration(RF24Ctx *ctx, uint32_t max_us);
 
 
   /**
@@ -126,13 +307,216 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    * @param len Size of the buffer
    * @param block Specify behaviour of recv((non)blocking)
    * @return length of payload received, -1 if corrupt
+   *
+   * Each pipe has its own receive queue.  Unless stated otherwise the
+   * receive functions take from any pipe, visiting pipes with packets
+   * waiting in turn, so a busy pipe can't starve the others.
+   *
+   * @warning Received packets are handed over through single consumer
+   * rings, so only one thread may call the any-pipe receive functions.
+   */
+  uint8_t rf24_recv(RF24Ctx *ctx, void* buf, uint8_t len, uint8_t block);
+  uint8_t rf24_recvfrom(RF24Ctx *ctx, void* buf, uint8_t len, uint8_t *from, uint8_t block);
+
+  /**
+   * rf24_recvfrom() giving up after timeout_ms, returns 0 if nothing came
+   */
+  uint8_t rf24_recvfrom_timed(RF24Ctx *ctx, void* buf, uint8_t len, uint8_t *from, int timeout_ms);
+
+  /**
+   * Read the next payload from any pipe, along with the pipe it came in on
+   *
+   * @param buf Pointer to a buffer where the data should be written
+   * @param len Size of the buffer
+   * @param[out] from Address of the sender, may be NULL
+   * @param[out] pipe Pipe the packet arrived on, may be NULL
+   * @param block Specify behaviour of recv((non)blocking)
+   * @return length of payload received, 0 if none (nonblocking)
    */
-  uint8_t rf24_recv(void* buf, uint8_t len, uint8_t block);
-  uint8_t rf24_recvfrom(void* buf, uint8_t len, uint8_t *from, uint8_t block);
+  uint8_t rf24_recv_any(RF24Ctx *ctx, void* buf, uint8_t len, uint8_t *from, uint8_t *pipe, uint8_t block);
 
-  int rf24_send(uint8_t *addr, const void* buf, uint8_t len);
+  /**
+   * Give a pipe its own reader, e.g. a control pipe that shouldn't wait
+   * behind bulk traffic on the others
+   *
+   * A claimed pipe is left out of the any-pipe receive functions, and the
+   * layers built on them, until it is released.  Its packets are read
+   * with rf24_recv_pipe() instead.
+   *
+   * @param pipe Which pipe to claim, 0-5
+   */
+  void rf24_claimPipe(RF24Ctx *ctx, uint8_t pipe);
+
+  /**
+   * Hand a claimed pipe back to the any-pipe receive functions, along
+   * with anything still queued on it.  Only call once nothing is blocked
+   * in rf24_recv_pipe() on it.
+   *
+   * @param pipe Which pipe to release, 0-5
+   */
+  void rf24_releasePipe(RF24Ctx *ctx, uint8_t pipe);
+
+  /**
+   * Read the next payload from a pipe claimed with rf24_claimPipe()
+   *
+   * Only one thread may call rf24_recv_pipe() for a pipe.
+   *
+   * @param pipe Which pipe to read from, 0-5
+   * @param buf Pointer to a buffer where the data should be written
+   * @param len Size of the buffer
+   * @param[out] from Address of the sender, may be NULL
+   * @param block Specify behaviour of recv((non)blocking)
+   * @return length of payload received, 0 if none (nonblocking) or the
+   * pipe isn't claimed
+   */
+  uint8_t rf24_recv_pipe(RF24Ctx *ctx, uint8_t pipe, void* buf, uint8_t len, uint8_t *from, uint8_t block);
+
+  /**
+   * Read up to count payloads in one call
+   *
+   * Like recvmmsg(), fills in as many messages as are already buffered.
+   * With block set, waits until at least one packet is available.
+   *
+   * @param msgs Array of count messages, buf and buf_len set by the caller
+   * @param count Maximum number of packets to receive
+   * @param block Specify behaviour of recv((non)blocking)
+   * @return number of messages filled in, 0 if none (nonblocking)
+   */
+  int rf24_recv_batch(RF24Ctx *ctx, RF24Message *msgs, int count, uint8_t block);
+
+  /**
+   * Borrow the next packet without copying it
+   *
+   * The payload is read in place from the driver's packet buffer, which
+   * must be handed back with rf24_release_view().  Buffers held this way
+   * are unavailable to the radio, so hold only a few at a time.
+   *
+   * @param[out] view Filled in with the packet
+   * @param block Specify behaviour of recv((non)blocking)
+   * @return True if a packet was received, false if none (nonblocking)
+   */
+  bool rf24_recv_view(RF24Ctx *ctx, RF24PacketView *view, uint8_t block);
+
+  /**
+   * Return a packet borrowed with rf24_recv_view()
+   *
+   * May be called from any thread.
+   */
+  void rf24_release_view(RF24Ctx *ctx, RF24PacketView *view);
+
+  /**
+   * Hand every received packet to a callback instead of the receive queues
+   *
+   * The handler runs on the radio's interrupt thread straight from the
+   * FIFO drain, skipping the queue and the wake up of a receiving thread.
+   * The view is only valid until the handler returns and must not be
+   * released; copy out anything needed later.  The handler holds up the
+   * next drain, so it should be quick and must not block.
+   *
+   * @param handler Called with each packet, NULL to go back to queueing
+   * @param arg Passed through to the handler
+   */
+  void rf24_set_rx_handler(RF24Ctx *ctx, rf24_rx_handler handler, void *arg);
+
+  int rf24_send(RF24Ctx *ctx, uint8_t *addr, const void* buf, uint8_t len);
+
+  /**
+   * Largest payload rf24_send() and friends accept
+   *
+   * Every frame starts with the sender's address, ADDR_WIDTH bytes, or a
+   * 1-byte ID when RF24Options.node_id is set, leaving 31 bytes.
+   */
+  uint8_t rf24_getMaxSendLen(RF24Ctx *ctx);
+
+  /**
+   * Map a compact node ID to a peer's full address
+   *
+   * With RF24Options.node_id set, senders identify themselves by ID and
+   * the receive calls look the address up here, so from still comes back
+   * as the full address.  Every node on the network must use compact IDs.
+   * Register peers before they start sending; an ID with no entry is
+   * reported as an all-zero address ending in the ID.
+   */
+  void rf24_setPeer(RF24Ctx *ctx, uint8_t id, const uint8_t *addr);
+
+  /**
+   * Send a packet without asking for an ACK
+   *
+   * Uses W_TX_PAYLOAD_NOACK, so the radio sends the frame once and goes
+   * straight on without waiting for an ACK or retransmitting.  Suits
+   * telemetry where a fresh reading beats a late one.  EN_DYN_ACK is
+   * turned on the first time it is used.
+   */
+  int rf24_send_noack(RF24Ctx *ctx, uint8_t *addr, const void* buf, uint8_t len);
+
+  /**
+   * rf24_send() with per-packet flags
+   *
+   * @param flags RF24_NOACK or 0
+   */
+  int rf24_send_flags(RF24Ctx *ctx, uint8_t *addr, const void* buf, uint8_t len, uint8_t flags);
+
+  /**
+   * Queue a packet to be sent without waiting for the radio
+   *
+   * Copies the packet onto a bounded queue drained by the radio's TX
+   * thread, which keeps the radio's TX FIFO loaded so frames go out back
+   * to back.  done is then called on that thread with RF24_TX_ACKED, or
+   * RF24_TX_MAX_RT once the retries run out; it must not block.
+   *
+   * @param addr Address to send to
+   * @param buf Payload, at most rf24_getMaxSendLen() bytes
+   * @param len Length of buf
+   * @param done Called once the send has finished, may be NULL
+   * @param arg Passed through to done
+   * @return 1 if queued, 0 if the queue is full or len is too long
+   */
+  int rf24_send_async(RF24Ctx *ctx, uint8_t *addr, const void* buf, uint8_t len,
+                      rf24_tx_handler done, void *arg);
+
+  /* Number of asynchronous sends not yet completed */
+  int rf24_txPending(RF24Ctx *ctx);
+
+  /**
+   * Let asynchronous sends gather before the TX thread starts on them
+   *
+   * Waiting sends are grouped by destination, keeping each destination's
+   * order, so TX_ADDR is rewritten less often when replies to several
+   * nodes are interleaved.  When the TX thread is woken from idle it
+   * waits window_us first so there is more to group; 0 (the default)
+   * only groups what has already piled up.
+   */
+  void rf24_setTXBatchWindow(RF24Ctx *ctx, uint32_t window_us);
+
+  /**
+   * Read the asynchronous send counters
+   */
+  void rf24_getTXStats(RF24Ctx *ctx, RF24TXStats *tx_stats);
+
+  /**
+   * Retransmits needed by the last frame to finish
+   *
+   * ARC_CNT as read by the interrupt thread when the frame was ACKed or
+   * ran out of retries, for rf24_write() and the asynchronous sends.
+   */
+  uint8_t rf24_getLastARC(RF24Ctx *ctx);
+
+  /**
+   * Stream a block of data to one address
+   *
+   * Splits buf into frames of rf24_getMaxSendLen() bytes and sends them back to
+   * back, holding CE high and refilling the TX FIFO as each is ACKed, so
+   * there is no RX/TX turnaround between frames. Blocks until the stream
+   * has gone or a frame runs out of retries, which abandons the rest.
+   *
+   * @param addr Address to send to
+   * @param buf Data to send
+   * @param len Length of buf
+   * @return Number of bytes known to have been ACKed, len on success
+   */
+  uint32_t rf24_send_stream(RF24Ctx *ctx, uint8_t *addr, const void* buf, uint32_t len);
   
-  void rf24_autoACKPacket();
+  void rf24_autoACKPacket(RF24Ctx *ctx);
 
   /**
    * Open a pipe for reading
@@ -158,7 +542,7 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    * @param pipe Which pipe# to open, 0-5.
    * @param address Up to 40-bit address of the pipe to open.
    */
-  void rf24_setRXAddressOnPipe(uint8_t *address, uint8_t pipe);
+  void rf24_setRXAddressOnPipe(RF24Ctx *ctx, uint8_t *address, uint8_t pipe);
 
   /**@}*/
   /**
@@ -176,14 +560,14 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    * max is 15.  0 means 250us, 15 means 4000us.
    * @param count How many retries before giving up, max 15
    */
-  void rf24_setRetries(uint8_t delay, uint8_t count);
+  void rf24_setRetries(RF24Ctx *ctx, uint8_t delay, uint8_t count);
 
   /**
    * Set RF communication channel
    *
    * @param channel Which RF channel to communicate on, 0-127
    */
-  void rf24_setChannel(uint8_t channel);
+  void rf24_setChannel(RF24Ctx *ctx, uint8_t channel);
 
   /**
    * Set Static Payload Size
@@ -197,7 +581,7 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    *
    * @param size The number of bytes in the payload
    */
-  void rf24_setPayloadSize(uint8_t size);
+  void rf24_setPayloadSize(RF24Ctx *ctx, uint8_t size);
 
   /**
    * Get Static Payload Size
@@ -206,10 +590,10 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    *
    * @return The number of bytes in the payload
    */
-  uint8_t rf24_getPayloadSize();
+  uint8_t rf24_getPayloadSize(RF24Ctx *ctx);
 
-  uint8_t rf24_setAddressWidth(uint8_t addr_width);
-  uint8_t rf24_getAddressWidth();
+  uint8_t rf24_setAddressWidth(RF24Ctx *ctx, uint8_t addr_width);
+  uint8_t rf24_getAddressWidth(RF24Ctx *ctx);
 
   /**
    * Enable custom payloads on the acknowledge packets
@@ -219,7 +603,7 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    *
    * @see examples/pingpair_pl/pingpair_pl.pde
    */
-  void rf24_enableAckPayload();
+  void rf24_enableAckPayload(RF24Ctx *ctx);
 
   /**
    * Enable dynamically-sized payloads
@@ -229,7 +613,7 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    *
    * @see examples/pingpair_pl/pingpair_dyn.pde
    */
-  void rf24_enableDynamicPayloads();
+  void rf24_enableDynamicPayloads(RF24Ctx *ctx);
 
   /**
    * Determine whether the hardware is an nRF24L01+ or not.
@@ -237,7 +621,7 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    * @return true if the hardware is nRF24L01+ (or compatible) and false
    * if its not.
    */
-  bool rf24_isPVariant() ;
+  bool rf24_isPVariant(RF24Ctx *ctx) ;
 
   /**
    * Enable or disable auto-acknowlede packets
@@ -247,7 +631,7 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    *
    * @param enable Whether to enable (true) or disable (false) auto-acks
    */
-  void rf24_setAutoAckOnAll(bool enable);
+  void rf24_setAutoAckOnAll(RF24Ctx *ctx, bool enable);
 
   /**
    * Enable or disable auto-acknowlede packets on a per pipeline basis.
@@ -258,7 +642,7 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    * @param pipe Which pipeline to modify
    * @param enable Whether to enable (true) or disable (false) auto-acks
    */
-  void rf24_setAutoAckOnPipe( uint8_t pipe, bool enable ) ;
+  void rf24_setAutoAckOnPipe(RF24Ctx *ctx, uint8_t pipe, bool enable) ;
 
   /**
    * Set Power Amplifier (PA) level to one of four levels.
@@ -269,7 +653,7 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    *
    * @param level Desired PA level.
    */
-  void rf24_setPALevel( rf24_pa_dbm_e level ) ;
+  void rf24_setPALevel(RF24Ctx *ctx, rf24_pa_dbm_e level) ;
 
   /**
    * Fetches the current PA level.
@@ -279,7 +663,7 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    * by the enum mnemonics are negative dBm. See setPALevel for
    * return value descriptions.
    */
-  rf24_pa_dbm_e rf24_getPALevel( void ) ;
+  rf24_pa_dbm_e rf24_getPALevel(RF24Ctx *ctx) ;
 
   /**
    * Set the transmission data rate
@@ -288,7 +672,7 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    *
    * @param speed RF24_250KBPS for 250kbs, RF24_1MBPS for 1Mbps, or RF24_2MBPS for 2Mbps
    */
-  void rf24_setDataRate(rf24_datarate_e speed);
+  void rf24_setDataRate(RF24Ctx *ctx, rf24_datarate_e speed);
   
   /**
    * Fetches the transmission data rate
@@ -297,27 +681,27 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    * is one of 250kbs, RF24_1MBPS for 1Mbps, or RF24_2MBPS, as defined in the
    * rf24_datarate_e enum.
    */
-  rf24_datarate_e rf24_getDataRate( void ) ;
+  rf24_datarate_e rf24_getDataRate(RF24Ctx *ctx) ;
 
   /**
    * Set the CRC length
    *
    * @param length RF24_CRC_8 for 8-bit or RF24_CRC_16 for 16-bit
    */
-  void rf24_setCRCLength(rf24_crclength_e length);
+  void rf24_setCRCLength(RF24Ctx *ctx, rf24_crclength_e length);
 
   /**
    * Get the CRC length
    *
    * @return RF24_DISABLED if disabled or RF24_CRC_8 for 8-bit or RF24_CRC_16 for 16-bit
    */
-  rf24_crclength_e rf24_getCRCLength();
+  rf24_crclength_e rf24_getCRCLength(RF24Ctx *ctx);
 
   /**
    * Disable CRC validation
    *
    */
-  void rf24_disableCRC( void ) ;
+  void rf24_disableCRC(RF24Ctx *ctx) ;
 
   /**@}*/
   /**
@@ -332,7 +716,7 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    *
    * @warning Does nothing if stdout is not defined.  See fdevopen in stdio.h
    */
-  void rf24_printDetails();
+  void rf24_printDetails(RF24Ctx *ctx);
 
   /**
    * Enter low-power mode
@@ -340,14 +724,14 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    * To return to normal power mode, either write() some data or
    * startListening, or powerUp().
    */
-  void rf24_powerDown();
+  void rf24_powerDown(RF24Ctx *ctx);
 
   /**
    * Leave low-power mode - making radio more responsive
    *
    * To return to low power mode, call powerDown().
    */
-  void rf24_powerUp() ;
+  void rf24_powerUp(RF24Ctx *ctx) ;
 
   /**
    * Test whether there are bytes available to be read
@@ -358,7 +742,7 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    * @param[out] pipe_num Which pipe has the payload available
    * @return True if there is a payload available, false if none is
    */
-  bool rf24_available(uint8_t* pipe_num);
+  bool rf24_available(RF24Ctx *ctx, uint8_t* pipe_num);
 
   /**
    * Non-blocking write to the open writing pipe
@@ -373,7 +757,7 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    * @param len Number of bytes to be sent
    * @return True if the payload was delivered successfully false if not
    */
-  void rf24_startWrite( const void* buf, uint8_t len );
+  void rf24_startWrite(RF24Ctx *ctx, const void* buf, uint8_t len);
 
   /**
    * Write an ack payload for the specified pipe
@@ -389,7 +773,32 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    * @param len Length of the data to send, up to 32 bytes max.  Not affected
    * by the static payload set by setPayloadSize().
    */
-  void rf24_writeAckPayload(uint8_t pipe, const void* buf, uint8_t len);
+  void rf24_writeAckPayload(RF24Ctx *ctx, uint8_t pipe, const void* buf, uint8_t len);
+
+  /**
+   * Queue a payload to go back to a node with a future ACK
+   *
+   * Each pipe keeps a short queue of payloads that the interrupt thread
+   * loads into the TX FIFO as earlier ones go out, one per pipe and at
+   * most three at once, so a hub can stream data down to its nodes on
+   * the ACKs to their traffic.  done is called on the interrupt thread
+   * with RF24_TX_ACKED once the node sends its next frame, showing it got
+   * the ACK, or RF24_TX_CANCELLED on close or rf24_stopListening(); it
+   * must not block.  Payloads are only loaded while listening.  Sending
+   * from this radio takes loaded ones back out of the TX FIFO, and they go
+   * back in first once it is listening again.  The first payload queued on
+   * a pipe turns on dynamic payloads for it and for pipe 0, as ACK payloads
+   * need; frames on other pipes keep their fixed size, and this radio's
+   * own sends are still padded unless rf24_enableDynamicPayloads() is on.
+   *
+   * @param pipe Pipe the node sends on
+   * @param buf Payload, up to 32 bytes, sent as is
+   * @param done Called once delivered, may be NULL
+   * @param arg Passed through to done
+   * @return 1 if queued, 0 if the pipe's queue is full
+   */
+  int rf24_queueAckPayload(RF24Ctx *ctx, uint8_t pipe, const void* buf, uint8_t len,
+                           rf24_tx_handler done, void *arg);
 
   /**
    * Determine if an ack payload was received in the most recent call to
@@ -404,7 +813,7 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    *
    * @return True if an ack payload is available.
    */
-  bool rf24_isAckPayloadAvailable();
+  bool rf24_isAckPayloadAvailable(RF24Ctx *ctx);
 
   /**
    * Call this when you get an interrupt to find out why
@@ -416,7 +825,7 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    * @param[out] tx_fail The send failed, too many retries (MAX_RT)
    * @param[out] rx_ready There is a message waiting to be read (RX_DS)
    */
-  void rf24_getStatus(bool *tx_ok, bool *tx_fail, bool *rx_ready);
+  void rf24_getStatus(RF24Ctx *ctx, bool *tx_ok, bool *tx_fail, bool *rx_ready);
 
   /**
    * Test whether there was a carrier on the line for the
@@ -426,7 +835,7 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    *
    * @return true if was carrier, false if not
    */
-  bool rf24_testCarrierDetect();
+  bool rf24_testCarrierDetect(RF24Ctx *ctx);
 
   /**
    * Test whether a signal (carrier or otherwise) greater than
@@ -438,7 +847,7 @@ typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e
    *
    * @return true if signal => -64dBm, false if not
    */
-  bool rf24_testRPD();
+  bool rf24_testRPD(RF24Ctx *ctx);
 
 
 #endif /* RF24_H */
\ No newline at end of file
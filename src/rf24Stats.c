@@ -14,6 +14,7 @@ typedef struct txrx_stats {
   struct timespec timer;
   pthread_mutex_t lock;
   pthread_t stats_thread;
+  uint8_t running; /* Monitor thread started */
 } TXRXStats;
 
 TXRXStats *stats_create(uint8_t interval) {
@@ -47,8 +48,10 @@ void stats_retrieve(TXRXStats *stats, uint32_t *tx_rate, uint32_t *rx_rate,
 
 void *monitor_thread(void *stats) {
     TXRXStats *s = (TXRXStats *)stats;
-    struct timespec t;
+    struct timespec t = {0, 0};
     for(;;) {
+        /* Only cancelled while sleeping, never holding the lock */
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
         pthread_mutex_lock(&(s->lock));
         s->tx_rate = s->bytes_tx / s->interval;
         s->rx_rate = s->bytes_rx / s->interval;
@@ -59,12 +62,24 @@ void *monitor_thread(void *stats) {
         t.tv_sec = s->timer.tv_sec;
         printf("<TX RATE: %d bytes/s>\n<RX RATE: %d bytes/s>\n", s->tx_rate, s->rx_rate);
         pthread_mutex_unlock(&(s->lock));
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
         nanosleep(&t, (struct timespec *)NULL);
     }
 }
 
 void stats_start_monitor(TXRXStats *stats) {
-    pthread_create(&(stats->stats_thread), NULL, monitor_thread, (void *) stats);
+    stats->running = !pthread_create(&(stats->stats_thread), NULL, monitor_thread, (void *) stats);
+}
+
+void stats_start_monitor_opts(TXRXStats *stats, const ThreadOpts *opts) {
+    stats->running = thread_create(&(stats->stats_thread), opts, monitor_thread, (void *) stats);
+}
+
+void stats_stop_monitor(TXRXStats *stats) {
+    if (!stats->running) return;
+    stats->running = 0;
+    pthread_cancel(stats->stats_thread);
+    pthread_join(stats->stats_thread, NULL);
 }
 
 void stats_destroy(TXRXStats *stats){
@@ -1,6 +1,7 @@
 #ifndef STATS_H
 #define STATS_H
 #include <stdint.h>
+#include "compatibility.h"
 
 #define STATS_TX 0
 #define STATS_RX 1
@@ -16,6 +17,10 @@ void stats_retrieve(TXRXStats *stats, uint32_t *tx_rate, uint32_t *rx_rate,
 
 void stats_start_monitor(TXRXStats *stats);
 
+void stats_start_monitor_opts(TXRXStats *stats, const ThreadOpts *opts);
+
+void stats_stop_monitor(TXRXStats *stats);
+
 void stats_destroy(TXRXStats *stats);
 
 #endif /* STATS_H */
\ No newline at end of file
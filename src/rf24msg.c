@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "rf24msg.h"
+#include "pool.h"
+#include "compatibility.h"
+
+#define FRAG_ID 0
+#define FRAG_INDEX 1
+#define FRAG_LEN 2 /* Total message length, little endian */
+#define FRAG_COUNT(_len) (((_len) + RF24MSG_FRAG_DATA - 1) / RF24MSG_FRAG_DATA)
+
+typedef struct reassembly {
+  uint8_t from[ADDR_WIDTH];
+  uint8_t id;
+  uint8_t frags; /* Fragments in the message */
+  uint8_t received; /* Fragments seen so far */
+  uint16_t len;
+  uint64_t started_ms;
+  uint8_t seen[(RF24MSG_MAX_FRAGS + 7) / 8];
+  uint8_t data[];
+} Reassembly;
+
+typedef struct rf24_msg_ctx {
+  RF24Ctx *radio;
+  pthread_mutex_t lock;
+  Pool *buffers;
+  Reassembly **partial; /* max_partial slots, NULL when free */
+  int max_partial;
+  uint16_t max_len;
+  int timeout_ms;
+  uint8_t next_id;
+  RF24MsgStats stats;
+} RF24MsgCtx;
+
+uint64_t now_ms() {
+  return monotonic_ns() / 1000000ULL;
+}
+
+RF24MsgCtx *rf24msg_create(RF24Ctx *radio, int max_partial, uint16_t max_len, int timeout_ms) {
+  RF24MsgCtx *m;
+  if (max_partial <= 0 || max_len == 0 || max_len > RF24MSG_MAX_LEN) return NULL;
+  if ((m = (RF24MsgCtx *)calloc(1, sizeof(RF24MsgCtx))) == NULL) return NULL;
+  m->radio = radio;
+  m->max_partial = max_partial;
+  m->max_len = max_len;
+  m->timeout_ms = timeout_ms;
+  pthread_mutex_init(&m->lock, NULL);
+  m->partial = (Reassembly **)calloc(max_partial, sizeof(Reassembly *));
+  m->buffers = pool_create(max_partial, sizeof(Reassembly) + max_len);
+  if (m->partial == NULL || m->buffers == NULL) {
+    rf24msg_destroy(m);
+    return NULL;
+  }
+  return m;
+}
+
+void rf24msg_destroy(RF24MsgCtx *m) {
+  if (m->buffers) pool_destroy(m->buffers);
+  pthread_mutex_destroy(&m->lock);
+  free(m->partial);
+  free(m);
+}
+
+/* Fragments of one rf24msg_send() still with the TX thread */
+typedef struct send_wait {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint16_t finished;
+  uint16_t failed;
+} SendWait;
+
+void fragment_done(rf24_tx_result_e result, void *arg) {
+  SendWait *w = (SendWait *)arg;
+  pthread_mutex_lock(&w->lock);
+  w->finished++;
+  if (result != RF24_TX_ACKED) w->failed++;
+  pthread_cond_signal(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+}
+
+/* Fragments are queued asynchronously so they go out back to back, and
+ * each one's ACK is checked; once one fails no more are queued */
+int rf24msg_send(RF24MsgCtx *m, uint8_t *addr, const void *buf, uint16_t len) {
+  uint8_t frame[RF24MSG_HEADER_LEN + RF24MSG_FRAG_DATA];
+  const uint8_t *data = (const uint8_t *)buf;
+  uint16_t frags = FRAG_COUNT(len), i = 0, chunk, finished;
+  SendWait w = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0};
+  if (len == 0 || frags > RF24MSG_MAX_FRAGS) return 0;
+  pthread_mutex_lock(&m->lock);
+  frame[FRAG_ID] = m->next_id++;
+  pthread_mutex_unlock(&m->lock);
+  frame[FRAG_LEN] = len & 0xFF;
+  frame[FRAG_LEN + 1] = len >> 8;
+  while (i < frags && !w.failed) {
+    pthread_mutex_lock(&w.lock);
+    finished = w.finished;
+    pthread_mutex_unlock(&w.lock);
+    chunk = (len - i * RF24MSG_FRAG_DATA < RF24MSG_FRAG_DATA ? len - i * RF24MSG_FRAG_DATA : RF24MSG_FRAG_DATA);
+    frame[FRAG_INDEX] = i;
+    memcpy(frame + RF24MSG_HEADER_LEN, data + i * RF24MSG_FRAG_DATA, chunk);
+    if (rf24_send_async(m->radio, addr, frame, RF24MSG_HEADER_LEN + chunk, fragment_done, &w)) {
+      i++;
+      continue;
+    }
+    /* TX queue full, wait for one of ours to go or, if it is all other
+     * senders' frames, a little while */
+    pthread_mutex_lock(&w.lock);
+    if (w.finished == finished && finished < i) pthread_cond_wait(&w.cond, &w.lock);
+    pthread_mutex_unlock(&w.lock);
+    if (finished == i) microSleep(1000);
+  }
+  pthread_mutex_lock(&w.lock);
+  while (w.finished < i) pthread_cond_wait(&w.cond, &w.lock);
+  pthread_mutex_unlock(&w.lock);
+  pthread_cond_destroy(&w.cond);
+  pthread_mutex_destroy(&w.lock);
+  return i == frags && !w.failed;
+}
+
+/* Drops partial messages that have waited too long, frees up buffers for
+ * senders that went quiet part way through */
+void expire_partial(RF24MsgCtx *m, uint64_t now) {
+  int i;
+  if (m->timeout_ms <= 0) return;
+  for (i = 0; i < m->max_partial; i++) {
+    if (m->partial[i] == NULL || now - m->partial[i]->started_ms < (uint64_t)m->timeout_ms) continue;
+    pool_free(m->buffers, m->partial[i]);
+    m->partial[i] = NULL;
+    m->stats.timed_out++;
+  }
+}
+
+/* Finds the sender's message in progress, or starts one. A sender has one
+ * message in flight at a time, so a new id means the old one is lost */
+Reassembly *find_partial(RF24MsgCtx *m, const uint8_t *from, uint8_t id, uint16_t len, uint64_t now) {
+  Reassembly *r;
+  int i, free_slot = -1;
+  for (i = 0; i < m->max_partial; i++) {
+    if ((r = m->partial[i]) == NULL) {
+      if (free_slot < 0) free_slot = i;
+      continue;
+    }
+    if (memcmp(r->from, from, ADDR_WIDTH)) continue;
+    if (r->id == id && r->len == len) return r;
+    memset(r->seen, 0, sizeof(r->seen)); /* Reuse the sender's buffer */
+    m->stats.replaced++;
+    goto start;
+  }
+  if (free_slot < 0 || (r = (Reassembly *)pool_alloc(m->buffers)) == NULL) {
+    m->stats.no_buffer++;
+    return NULL;
+  }
+  memset(r->seen, 0, sizeof(r->seen));
+  memcpy(r->from, from, ADDR_WIDTH);
+  m->partial[free_slot] = r;
+start:
+  r->id = id;
+  r->len = len;
+  r->frags = FRAG_COUNT(len);
+  r->received = 0;
+  r->started_ms = now;
+  return r;
+}
+
+uint16_t rf24msg_input(RF24MsgCtx *m, const uint8_t *from, const void *frag, uint8_t frag_len,
+                       void *buf, uint16_t buf_len) {
+  const uint8_t *f = (const uint8_t *)frag;
+  uint64_t now = now_ms();
+  uint16_t len, offset, chunk;
+  Reassembly *r;
+  int i;
+  if (frag_len < RF24MSG_HEADER_LEN) goto malformed;
+  len = f[FRAG_LEN] | (f[FRAG_LEN + 1] << 8);
+  if (len == 0 || len > m->max_len || f[FRAG_INDEX] >= FRAG_COUNT(len)) goto malformed;
+  offset = f[FRAG_INDEX] * RF24MSG_FRAG_DATA;
+  chunk = (len - offset < RF24MSG_FRAG_DATA ? len - offset : RF24MSG_FRAG_DATA);
+  if (frag_len - RF24MSG_HEADER_LEN < chunk) goto malformed; /* Fixed payloads pad the last */
+
+  pthread_mutex_lock(&m->lock);
+  expire_partial(m, now);
+  if ((r = find_partial(m, from, f[FRAG_ID], len, now)) == NULL) goto done;
+  if (r->seen[f[FRAG_INDEX] / 8] & (1 << (f[FRAG_INDEX] % 8))) {
+    m->stats.duplicates++;
+    goto done;
+  }
+  r->seen[f[FRAG_INDEX] / 8] |= 1 << (f[FRAG_INDEX] % 8);
+  memcpy(r->data + offset, f + RF24MSG_HEADER_LEN, chunk);
+  if (++r->received < r->frags) goto done;
+
+  /* Complete, hand it over and free the buffer */
+  memcpy(buf, r->data, (len < buf_len ? len : buf_len));
+  for (i = 0; m->partial[i] != r; i++);
+  m->partial[i] = NULL;
+  pool_free(m->buffers, r);
+  m->stats.delivered++;
+  pthread_mutex_unlock(&m->lock);
+  return len;
+done:
+  pthread_mutex_unlock(&m->lock);
+  return 0;
+malformed:
+  pthread_mutex_lock(&m->lock);
+  m->stats.malformed++;
+  pthread_mutex_unlock(&m->lock);
+  return 0;
+}
+
+uint16_t rf24msg_recv(RF24MsgCtx *m, void *buf, uint16_t buf_len, uint8_t *from, uint8_t block) {
+  uint8_t frame[RF24MSG_HEADER_LEN + RF24MSG_FRAG_DATA], sender[ADDR_WIDTH], n;
+  uint16_t len;
+  for (;;) {
+    if ((n = rf24_recvfrom(m->radio, frame, sizeof(frame), sender, block)) == 0) return 0;
+    if ((len = rf24msg_input(m, sender, frame, n, buf, buf_len))) {
+      if (from) memcpy(from, sender, ADDR_WIDTH);
+      return len;
+    }
+  }
+}
+
+void rf24msg_getStats(RF24MsgCtx *m, RF24MsgStats *stats) {
+  pthread_mutex_lock(&m->lock);
+  *stats = m->stats;
+  pthread_mutex_unlock(&m->lock);
+}
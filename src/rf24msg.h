@@ -0,0 +1,51 @@
+#ifndef RF24MSG_H
+#define RF24MSG_H
+#include <stdint.h>
+#include "rf24.h"
+
+/* Each fragment carries {id, index, total length (2 bytes, LE)} ahead of
+ * its share of the message, leaving 23 bytes of data per frame */
+#define RF24MSG_HEADER_LEN 4
+#define RF24MSG_FRAG_DATA (32 - ADDR_WIDTH - RF24MSG_HEADER_LEN)
+#define RF24MSG_MAX_FRAGS 255
+#define RF24MSG_MAX_LEN (RF24MSG_MAX_FRAGS * RF24MSG_FRAG_DATA)
+
+typedef struct rf24_msg_ctx RF24MsgCtx;
+
+typedef struct rf24_msg_stats {
+  uint32_t delivered; /* Whole messages handed to the caller */
+  uint32_t timed_out; /* Partial messages dropped after the timeout */
+  uint32_t replaced; /* Partial messages dropped when the sender started another */
+  uint32_t no_buffer; /* Fragments dropped with every buffer in use */
+  uint32_t duplicates; /* Fragments already received */
+  uint32_t malformed; /* Fragments that don't fit the message they claim */
+} RF24MsgStats;
+
+/* Messages of up to max_len bytes (at most RF24MSG_MAX_LEN) are split over
+ * several frames by rf24msg_send() and put back together per sender by
+ * rf24msg_recv(). At most max_partial messages are reassembled at once,
+ * in buffers allocated up front; one not completed within timeout_ms is
+ * dropped (0 waits forever). radio may be NULL if fragments are only fed in by hand */
+RF24MsgCtx *rf24msg_create(RF24Ctx *radio, int max_partial, uint16_t max_len, int timeout_ms);
+void rf24msg_destroy(RF24MsgCtx *m);
+
+/* Sends len bytes to addr through the radio's asynchronous TX queue and
+ * waits for every fragment's ACK. Returns 0 if len is 0 or too long, or a
+ * fragment was not ACKed, in which case the rest are not sent and the
+ * receiver drops the partial message */
+int rf24msg_send(RF24MsgCtx *m, uint8_t *addr, const void *buf, uint16_t len);
+
+/* Receives fragments until a message is complete and copies it to buf,
+ * truncated to buf_len. Returns the message length, or 0 if block is
+ * FALSE and no message is complete yet */
+uint16_t rf24msg_recv(RF24MsgCtx *m, void *buf, uint16_t buf_len, uint8_t *from, uint8_t block);
+
+/* Adds a fragment received by other means, e.g. an rf24_set_rx_handler()
+ * callback. Returns the message length if it completed one, copied to
+ * buf as rf24msg_recv() does, else 0 */
+uint16_t rf24msg_input(RF24MsgCtx *m, const uint8_t *from, const void *frag, uint8_t frag_len,
+                       void *buf, uint16_t buf_len);
+
+void rf24msg_getStats(RF24MsgCtx *m, RF24MsgStats *stats);
+
+#endif /* RF24MSG_H */
@@ -0,0 +1,310 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rf24reliable.h"
+#include "compatibility.h"
+
+#define REL_DATA 0x01 /* {type, seq, len, data} */
+#define REL_ACK 0x02 /* {type, next seq expected, window limit, SACK bitmap of the 32 after it} */
+#define REL_PROBE 0x03 /* {type}, asks for an ACK while the peer's window is shut */
+#define DATA_HDR_LEN 3
+#define ACK_LEN 7
+#define ACK_SACK 3
+#define SACK_BITS 32
+#define FRAME_MAX 32
+#define SLOT(_seq) ((_seq) & (RF24REL_MAX_WINDOW - 1)) /* 64 divides 256, so seqs wrap cleanly */
+#define SEQ_IN(_seq, _base, _count) ((uint8_t)((_seq) - (_base)) < (_count))
+#define RTO_INIT_US 50000
+#define RTO_MIN_US 2000
+#define RTO_MAX_US 1000000
+
+typedef struct segment {
+  uint8_t len;
+  uint8_t sends; /* Times sent, RTT is only sampled from frames sent once */
+  uint8_t done; /* ACKed (sender) or received (receiver) */
+  uint64_t sent_ns;
+  uint8_t data[FRAME_MAX - DATA_HDR_LEN];
+} Segment;
+
+typedef struct rf24_reliable {
+  RF24Ctx *radio;
+  uint8_t peer[ADDR_WIDTH];
+  uint8_t window;
+  uint8_t seg_len; /* Data bytes per frame */
+  /* Sending side, snd_una..snd_nxt are in flight, nothing from snd_lim on
+   * may be sent until the peer's window opens */
+  uint8_t snd_una;
+  uint8_t snd_nxt;
+  uint8_t snd_lim;
+  uint8_t lim_heard; /* snd_lim came from the peer rather than our own window */
+  uint8_t broken;
+  uint8_t probing; /* Window shut with nothing in flight */
+  uint64_t probe_ns; /* Last probe, or when probing started */
+  uint32_t probe_us; /* Wait before the next probe, backs off like the RTO */
+  uint32_t srtt_us;
+  uint32_t rttvar_us;
+  uint32_t rto_us;
+  Segment snd[RF24REL_MAX_WINDOW];
+  /* Receiving side, rcv_base..rcv_nxt are in order and unread */
+  uint8_t rcv_base;
+  uint8_t rcv_nxt;
+  uint8_t rcv_off; /* Bytes of rcv_base already read */
+  uint8_t rcv_adv; /* Window limit in the last ACK */
+  uint8_t ack_due;
+  Segment rcv[RF24REL_MAX_WINDOW];
+  RF24ReliableStats stats;
+} RF24Reliable;
+
+RF24Reliable *rf24rel_create(RF24Ctx *radio, const uint8_t *peer, uint8_t window) {
+  RF24Reliable *s;
+  if (window == 0 || window > RF24REL_MAX_WINDOW) return NULL;
+  if ((s = (RF24Reliable *)calloc(1, sizeof(RF24Reliable))) == NULL) return NULL;
+  s->radio = radio;
+  memcpy(s->peer, peer, ADDR_WIDTH);
+  s->window = window;
+  s->seg_len = rf24_getMaxSendLen(radio) - DATA_HDR_LEN;
+  s->rto_us = RTO_INIT_US;
+  s->snd_lim = s->rcv_adv = window; /* Until the peer says otherwise */
+  return s;
+}
+
+void rf24rel_destroy(RF24Reliable *s) {
+  free(s);
+}
+
+void send_segment(RF24Reliable *s, uint8_t seq) {
+  uint8_t frame[FRAME_MAX];
+  Segment *seg = &s->snd[SLOT(seq)];
+  frame[0] = REL_DATA;
+  frame[1] = seq;
+  frame[2] = seg->len;
+  memcpy(frame + DATA_HDR_LEN, seg->data, seg->len);
+  rf24_send_noack(s->radio, s->peer, frame, DATA_HDR_LEN + seg->len);
+  seg->sent_ns = monotonic_ns();
+  seg->sends++;
+}
+
+/* ACKs what has arrived and advertises how far the peer may send, which
+ * only moves on as the reader frees buffers */
+void send_ack(RF24Reliable *s) {
+  uint8_t frame[ACK_LEN] = {REL_ACK, s->rcv_nxt, (uint8_t)(s->rcv_base + s->window)};
+  uint8_t i, seq;
+  for (i = 0; i < SACK_BITS; i++) {
+    seq = s->rcv_nxt + 1 + i;
+    if (SEQ_IN(seq, s->rcv_base, s->window) && s->rcv[SLOT(seq)].done)
+      frame[ACK_SACK + i / 8] |= 1 << (i % 8);
+  }
+  rf24_send_noack(s->radio, s->peer, frame, ACK_LEN);
+  s->rcv_adv = frame[2];
+  s->ack_due = FALSE;
+  s->stats.acks_sent++;
+}
+
+void send_probe(RF24Reliable *s) {
+  uint8_t frame[1] = {REL_PROBE};
+  rf24_send_noack(s->radio, s->peer, frame, sizeof(frame));
+  s->probe_ns = monotonic_ns();
+  if ((s->probe_us *= 2) > RTO_MAX_US) s->probe_us = RTO_MAX_US;
+  s->stats.probes++;
+}
+
+/* New frames that may go out now, limited by our window and the peer's */
+uint8_t send_room(RF24Reliable *s) {
+  uint8_t room = s->window - (uint8_t)(s->snd_nxt - s->snd_una), open = s->snd_lim - s->snd_nxt;
+  if (open > 2 * RF24REL_MAX_WINDOW) return 0; /* Limit is behind us, sent before it was known */
+  return (open < room ? open : room);
+}
+
+/* Smoothed RTT and timeout as in RFC 6298 */
+void rtt_sample(RF24Reliable *s, uint32_t rtt_us) {
+  uint32_t delta;
+  if (s->srtt_us == 0) {
+    s->srtt_us = rtt_us;
+    s->rttvar_us = rtt_us / 2;
+  } else {
+    delta = (s->srtt_us > rtt_us ? s->srtt_us - rtt_us : rtt_us - s->srtt_us);
+    s->rttvar_us = (3 * s->rttvar_us + delta) / 4;
+    s->srtt_us = (7 * s->srtt_us + rtt_us) / 8;
+  }
+  s->rto_us = s->srtt_us + 4 * s->rttvar_us;
+  if (s->rto_us < RTO_MIN_US) s->rto_us = RTO_MIN_US;
+  if (s->rto_us > RTO_MAX_US) s->rto_us = RTO_MAX_US;
+}
+
+void mark_acked(RF24Reliable *s, uint8_t seq, uint64_t now) {
+  Segment *seg = &s->snd[SLOT(seq)];
+  if (seg->done) return;
+  seg->done = TRUE;
+  if (seg->sends == 1) rtt_sample(s, (now - seg->sent_ns) / 1000);
+}
+
+void handle_ack(RF24Reliable *s, const uint8_t *frame) {
+  uint8_t in_flight = s->snd_nxt - s->snd_una, cum = frame[1], seq, i, highest = s->snd_una;
+  uint32_t srtt = (s->srtt_us ? s->srtt_us : s->rto_us);
+  uint64_t now = monotonic_ns();
+  s->stats.acks_received++;
+  /* The limit never moves back, nor on by more than a window, older ACKs fail this */
+  if (!s->lim_heard || (uint8_t)(frame[2] - s->snd_lim) <= RF24REL_MAX_WINDOW) s->snd_lim = frame[2];
+  s->lim_heard = TRUE;
+  if ((uint8_t)(cum - s->snd_una) > in_flight) return; /* Stale */
+  for (seq = s->snd_una; seq != cum; seq++) mark_acked(s, seq, now);
+  for (i = 0; i < SACK_BITS; i++) {
+    seq = cum + 1 + i;
+    if (!SEQ_IN(seq, s->snd_una, in_flight)) break;
+    if (!(frame[ACK_SACK + i / 8] & (1 << (i % 8)))) continue;
+    mark_acked(s, seq, now);
+    highest = seq;
+  }
+  while (s->snd_una != s->snd_nxt && s->snd[SLOT(s->snd_una)].done) s->snd_una++;
+  if (!SEQ_IN(highest, s->snd_una, (uint8_t)(s->snd_nxt - s->snd_una))) return;
+  /* Frames behind one the peer has were most likely lost, resend those
+   * that have had a round trip to arrive rather than wait for the timer */
+  for (seq = s->snd_una; seq != highest; seq++) {
+    if (s->snd[SLOT(seq)].done || now - s->snd[SLOT(seq)].sent_ns < (uint64_t)srtt * 1000) continue;
+    send_segment(s, seq);
+    s->stats.fast_retransmits++;
+  }
+}
+
+void handle_data(RF24Reliable *s, const uint8_t *frame, uint8_t frame_len) {
+  uint8_t seq = frame[1], len = frame[2];
+  Segment *seg = &s->rcv[SLOT(seq)];
+  s->ack_due = TRUE; /* Even for a duplicate, the last ACK may have been lost */
+  if (len > s->seg_len || frame_len < DATA_HDR_LEN + len) return;
+  if (!SEQ_IN(seq, s->rcv_base, s->window) && SEQ_IN(seq, s->rcv_base, 2 * s->window)) {
+    s->stats.overrun++; /* Past what we can buffer, sent before our window was known */
+    return;
+  }
+  if (!SEQ_IN(seq, s->rcv_base, s->window) || seg->done) {
+    s->stats.duplicates++;
+    return;
+  }
+  memcpy(seg->data, frame + DATA_HDR_LEN, len);
+  seg->len = len;
+  seg->done = TRUE;
+  if (seq != s->rcv_nxt) s->stats.out_of_order++;
+  while (SEQ_IN(s->rcv_nxt, s->rcv_base, s->window) && s->rcv[SLOT(s->rcv_nxt)].done) s->rcv_nxt++;
+}
+
+/* Resends frames whose timer has run out, backing the timeout off, and
+ * probes a shut window. Probes go unanswered while the peer isn't reading,
+ * so they never count towards RF24REL_MAX_RETRIES */
+void check_timers(RF24Reliable *s) {
+  uint64_t now = monotonic_ns();
+  uint8_t seq, fired = FALSE;
+  Segment *seg;
+  if (s->probing && now - s->probe_ns >= (uint64_t)s->probe_us * 1000) send_probe(s);
+  for (seq = s->snd_una; seq != s->snd_nxt; seq++) {
+    seg = &s->snd[SLOT(seq)];
+    if (seg->done || now - seg->sent_ns < (uint64_t)s->rto_us * 1000) continue;
+    if (seg->sends >= RF24REL_MAX_RETRIES) {
+      s->broken = TRUE;
+      return;
+    }
+    send_segment(s, seq);
+    s->stats.retransmits++;
+    fired = TRUE;
+  }
+  if (fired && (s->rto_us *= 2) > RTO_MAX_US) s->rto_us = RTO_MAX_US;
+}
+
+/* Milliseconds until the next retransmission is due, -1 if none */
+int next_timer_ms(RF24Reliable *s) {
+  uint64_t now = monotonic_ns(), due, first = UINT64_MAX;
+  uint8_t seq;
+  for (seq = s->snd_una; seq != s->snd_nxt; seq++) {
+    if (s->snd[SLOT(seq)].done) continue;
+    due = s->snd[SLOT(seq)].sent_ns + (uint64_t)s->rto_us * 1000;
+    if (due < first) first = due;
+  }
+  if (s->probing && (due = s->probe_ns + (uint64_t)s->probe_us * 1000) < first) first = due;
+  if (first == UINT64_MAX) return -1;
+  return (first > now ? (int)((first - now + 999999) / 1000000) : 0);
+}
+
+/* Takes in whatever the peer sent within timeout_ms (-1 for no limit),
+ * then answers it and runs the retransmission timers */
+void service(RF24Reliable *s, int timeout_ms) {
+  uint8_t frame[FRAME_MAX], from[ADDR_WIDTH], len;
+  int timer = next_timer_ms(s);
+  if (timer >= 0 && (timeout_ms < 0 || timer < timeout_ms)) timeout_ms = timer;
+  while ((len = rf24_recvfrom_timed(s->radio, frame, sizeof(frame), from, timeout_ms)) > 0) {
+    timeout_ms = 0; /* Drain what has arrived, then answer it all at once */
+    if (memcmp(from, s->peer, ADDR_WIDTH)) s->stats.foreign++;
+    else if (frame[0] == REL_ACK && len >= ACK_LEN) handle_ack(s, frame);
+    else if (frame[0] == REL_DATA && len >= DATA_HDR_LEN) handle_data(s, frame, len);
+    else if (frame[0] == REL_PROBE) s->ack_due = TRUE;
+  }
+  if (s->ack_due) send_ack(s);
+  check_timers(s);
+}
+
+int rf24rel_write(RF24Reliable *s, const void *buf, int len) {
+  const uint8_t *data = (const uint8_t *)buf;
+  Segment *seg;
+  int done = 0;
+  while (done < len) {
+    if (s->broken) return -1;
+    if (send_room(s) == 0) {
+      if (s->snd_una == s->snd_nxt && !s->probing) { /* Only the peer's reader can open it */
+        s->probing = TRUE;
+        s->probe_ns = monotonic_ns();
+        s->probe_us = s->rto_us;
+      }
+      service(s, -1); /* Window full, wait for ACKs */
+      continue;
+    }
+    s->probing = FALSE;
+    seg = &s->snd[SLOT(s->snd_nxt)];
+    seg->len = (len - done < s->seg_len ? len - done : s->seg_len);
+    seg->sends = 0;
+    seg->done = FALSE;
+    memcpy(seg->data, data + done, seg->len);
+    done += seg->len;
+    send_segment(s, s->snd_nxt++);
+    s->stats.sent++;
+    service(s, 0);
+  }
+  return (s->broken ? -1 : len);
+}
+
+int rf24rel_flush(RF24Reliable *s, int timeout_ms) {
+  uint64_t deadline = monotonic_ns() + (uint64_t)timeout_ms * 1000000ULL, now;
+  while (s->snd_una != s->snd_nxt) {
+    if (s->broken) return -1;
+    if ((now = monotonic_ns()) >= deadline) return 0;
+    service(s, (int)((deadline - now + 999999) / 1000000));
+  }
+  return 1;
+}
+
+int rf24rel_read(RF24Reliable *s, void *buf, int len, int timeout_ms) {
+  uint64_t deadline = monotonic_ns() + (uint64_t)(timeout_ms > 0 ? timeout_ms : 0) * 1000000ULL, now;
+  uint8_t *out = (uint8_t *)buf;
+  Segment *seg;
+  int got = 0, chunk;
+  service(s, 0); /* Even when not waiting, take in and answer what has arrived */
+  while (s->rcv_base == s->rcv_nxt) {
+    now = monotonic_ns();
+    if (timeout_ms >= 0 && now >= deadline) return 0;
+    service(s, (timeout_ms < 0 ? -1 : (int)((deadline - now + 999999) / 1000000)));
+  }
+  while (got < len && s->rcv_base != s->rcv_nxt) {
+    seg = &s->rcv[SLOT(s->rcv_base)];
+    chunk = (seg->len - s->rcv_off < len - got ? seg->len - s->rcv_off : len - got);
+    memcpy(out + got, seg->data + s->rcv_off, chunk);
+    got += chunk;
+    if ((s->rcv_off += chunk) < seg->len) break;
+    seg->done = FALSE; /* Slot is free for seq + 64 */
+    s->rcv_off = 0;
+    s->rcv_base++;
+  }
+  /* Tell a writer waiting on our window once half of it has opened up */
+  if ((uint8_t)(s->rcv_base + s->window - s->rcv_adv) >= (s->window + 1) / 2) send_ack(s);
+  return got;
+}
+
+void rf24rel_getStats(RF24Reliable *s, RF24ReliableStats *stats) {
+  *stats = s->stats;
+  stats->srtt_us = s->srtt_us;
+  stats->rto_us = s->rto_us;
+}
@@ -0,0 +1,55 @@
+#ifndef RF24RELIABLE_H
+#define RF24RELIABLE_H
+#include <stdint.h>
+#include "rf24.h"
+
+/* A reliable, in-order byte stream to one peer. Frames go out with NOACK
+ * so the radio never stalls on retransmits; sequence numbers, cumulative
+ * plus selective ACKs and an RTT-based retransmission timer do the job
+ * end to end, with up to window frames in flight (at most 64). ACKs also
+ * carry how much the receiver has room for, so a slow reader holds the
+ * writer back rather than having frames dropped.
+ *
+ * Both ends create their stream before either sends and there is no
+ * handshake, so a restarted end needs a new stream on the other side too.
+ * The stream only makes progress inside its calls, which receive from the
+ * radio and drop frames from anyone but the peer, so one thread should
+ * drive it and a reader should keep calling rf24rel_read() */
+#define RF24REL_MAX_WINDOW 64
+#define RF24REL_MAX_RETRIES 12 /* Sends of one frame before the stream is broken */
+
+typedef struct rf24_reliable RF24Reliable;
+
+typedef struct rf24_reliable_stats {
+  uint32_t sent; /* Data frames, first transmissions */
+  uint32_t retransmits; /* Data frames sent again on a timeout */
+  uint32_t fast_retransmits; /* Data frames sent again as later ones were ACKed */
+  uint32_t acks_sent;
+  uint32_t acks_received;
+  uint32_t duplicates; /* Data frames received twice */
+  uint32_t overrun; /* Data frames past the receive window, dropped */
+  uint32_t probes; /* Sent while the peer's window was shut */
+  uint32_t out_of_order; /* Data frames held for an earlier one */
+  uint32_t foreign; /* Frames from other senders dropped */
+  uint32_t srtt_us; /* Smoothed round trip time */
+  uint32_t rto_us; /* Current retransmission timeout */
+} RF24ReliableStats;
+
+RF24Reliable *rf24rel_create(RF24Ctx *radio, const uint8_t *peer, uint8_t window);
+void rf24rel_destroy(RF24Reliable *s);
+
+/* Queues len bytes, blocking while the window is full. Returns len, or -1
+ * once a frame has gone unACKed RF24REL_MAX_RETRIES times */
+int rf24rel_write(RF24Reliable *s, const void *buf, int len);
+
+/* Waits up to timeout_ms for everything written to be ACKed. Returns 1
+ * once it has, 0 on timeout or -1 if the stream is broken */
+int rf24rel_flush(RF24Reliable *s, int timeout_ms);
+
+/* Reads up to len bytes in order, waiting up to timeout_ms for the first.
+ * Returns the number read, 0 on timeout */
+int rf24rel_read(RF24Reliable *s, void *buf, int len, int timeout_ms);
+
+void rf24rel_getStats(RF24Reliable *s, RF24ReliableStats *stats);
+
+#endif /* RF24RELIABLE_H */
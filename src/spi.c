@@ -26,6 +26,8 @@ typedef struct spi_state {
 	uint8_t bits;
 	int fd;
 	uint8_t chip_select;
+	uint8_t gpio_cs; /* Chip select driven by us rather than spidev */
+	GPIOLine *cs_line;
 	pthread_mutex_t lock;
 } SPIState;
 
@@ -34,6 +36,7 @@ SPIState *spi_init(char *device, uint32_t mode, uint8_t bits, uint32_t speed, ui
 	SPIState *spi = (SPIState *) malloc(sizeof(SPIState));
 	if (spi == NULL) return NULL;
 	SET_SPI(spi, mode, bits, speed, chip_select);
+	spi->gpio_cs = (chip_select != SPI_DRIVER_CS);
 	printf("SPI config: mode %d, %d bit, %dMhz\n",spi->mode, spi->bits, (spi->speed)/1000000);
 	spi->fd = open(device, O_RDWR);
 	if (spi->fd < 0) {
@@ -76,15 +79,21 @@ SPIState *spi_init(char *device, uint32_t mode, uint8_t bits, uint32_t speed, ui
 		perror("ERROR: Can't set max speed hz");
 		return NULL;						
 	}
-	gpio_open(spi->chip_select, GPIO_OUT);
-	spi_disable(spi); /* Ensures chip select is pulled up */
 	pthread_mutex_init(&(spi->lock), NULL);
+	if (spi->gpio_cs) {
+		spi->cs_line = gpio_line_open(spi->chip_select, GPIO_OUT);
+		if (spi->cs_line == NULL) {
+			perror("ERROR: Can't open chip select GPIO");
+			return NULL;
+		}
+		gpio_line_write(spi->cs_line, GPIO_HIGH); /* Ensures chip select is pulled up */
+	}
 	return spi;
 }
 
 void spi_enable(SPIState *spi){
 	pthread_mutex_lock(&(spi->lock));
-	gpio_write(spi->chip_select, GPIO_LOW);
+	if (spi->gpio_cs) gpio_line_write(spi->cs_line, GPIO_LOW);
 }
 
 uint8_t spi_transfer(SPIState *spi, uint8_t val, uint8_t *rx) {
@@ -114,17 +123,16 @@ uint8_t spi_transfer(SPIState *spi, uint8_t val, uint8_t *rx) {
 	return 1;
 }
 
-uint8_t spi_transfer_bulk(SPIState *spi, uint8_t *tx, uint8_t *rx, uint8_t len) {
+uint8_t spi_transfer_bulk(SPIState *spi, const uint8_t *tx, uint8_t *rx, uint8_t len) {
 	if (spi == NULL) {
 		perror("ERROR: NULL spi state");
 		return 0;
 	}
 	int ret;
-	uint8_t rx_val[len];
-	memset(rx_val, 0, len);
 	struct spi_ioc_transfer tr;
+	memset(&tr, 0, sizeof(struct spi_ioc_transfer));
 	tr.tx_buf = (unsigned long)tx;
-	tr.rx_buf = (unsigned long)rx_val;
+	tr.rx_buf = (unsigned long)rx; /* Full duplex, rx may alias tx */
 	tr.len = len;
 	tr.delay_usecs = 0;
 	tr.cs_change = 0;
@@ -136,18 +144,58 @@ uint8_t spi_transfer_bulk(SPIState *spi, uint8_t *tx, uint8_t *rx, uint8_t len)
 		perror("ERROR: can't send spi message");
 		return 0;		
 	}
-	if (rx != NULL) memcpy(rx, rx_val, len);
+	return 1;
+}
+
+uint8_t spi_transfer_seq(SPIState *spi, const SPIMessage *msgs, uint8_t count) {
+	if (spi == NULL) {
+		perror("ERROR: NULL spi state");
+		return 0;
+	}
+	int ret, i;
+	struct spi_ioc_transfer tr[SPI_MAX_MESSAGES];
+	if (count == 0 || count > SPI_MAX_MESSAGES) return 0;
+	memset(tr, 0, sizeof(tr));
+	for (i = 0; i < count; i++) {
+		tr[i].tx_buf = (unsigned long)msgs[i].tx;
+		tr[i].rx_buf = (unsigned long)msgs[i].rx;
+		tr[i].len = msgs[i].len;
+		tr[i].cs_change = (i < count - 1); /* Deselect between messages */
+		tr[i].speed_hz = spi->speed;
+		tr[i].bits_per_word = spi->bits;
+	}
+
+	pthread_mutex_lock(&(spi->lock));
+	if (spi->gpio_cs) {
+		/* spidev can't toggle our GPIO mid-message, so split the sequence */
+		for (ret = 1, i = 0; i < count && ret >= 1; i++) {
+			gpio_line_write(spi->cs_line, GPIO_LOW);
+			tr[i].cs_change = 0;
+			ret = ioctl(spi->fd, SPI_IOC_MESSAGE(1), &tr[i]);
+			gpio_line_write(spi->cs_line, GPIO_HIGH);
+		}
+	} else {
+		ret = ioctl(spi->fd, SPI_IOC_MESSAGE(count), tr);
+	}
+	pthread_mutex_unlock(&(spi->lock));
+	if (ret < 1) {
+		perror("ERROR: can't send spi message");
+		return 0;
+	}
 	return 1;
 }
 
 void spi_disable(SPIState *spi){
-	gpio_write(spi->chip_select, GPIO_HIGH);
+	if (spi->gpio_cs) gpio_line_write(spi->cs_line, GPIO_HIGH);
 	pthread_mutex_unlock(&(spi->lock));
 }
 
 void spi_close(SPIState *spi){
 	pthread_mutex_lock(&(spi->lock));
 	close(spi->fd);
+	if (spi->gpio_cs) gpio_line_close(spi->cs_line);
 	pthread_mutex_unlock(&(spi->lock));
+	pthread_mutex_destroy(&(spi->lock));
+	free(spi);
 }
 
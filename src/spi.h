@@ -4,11 +4,33 @@
 
 typedef struct spi_state SPIState; /* opaque type definition */
 
+/* Pass as chip_select to let the spidev driver assert chip select itself
+ * rather than toggling a GPIO around every transaction */
+#define SPI_DRIVER_CS 0xFF
+
+/* Maximum number of messages in a single spi_transfer_seq() call */
+#define SPI_MAX_MESSAGES 8
+
+/* A single chip select delimited command within a sequence.
+ * rx may be NULL or alias tx */
+typedef struct spi_message {
+	const uint8_t *tx;
+	uint8_t *rx;
+	uint8_t len;
+} SPIMessage;
+
 SPIState *spi_init(char *device, uint32_t mode, uint8_t bits, uint32_t speed, uint8_t chip_select);
 void spi_enable(SPIState *spi); 
 uint8_t spi_transfer(SPIState *spi, uint8_t val, uint8_t *rx);
-uint8_t spi_transfer_bulk(SPIState *spi, uint8_t *tx, uint8_t *rx, uint8_t len);
+/* Clocks len bytes of tx out whilst clocking len bytes into rx in a single
+ * transfer; rx may be NULL or alias tx. Returns 1 if successful, 0 otherwise */
+uint8_t spi_transfer_bulk(SPIState *spi, const uint8_t *tx, uint8_t *rx, uint8_t len);
 void spi_disable(SPIState *spi);
+
+/* Transfers count messages, deselecting the chip between each, in a single
+ * SPI_IOC_MESSAGE ioctl. Takes the bus itself, so it must not be wrapped
+ * in spi_enable/spi_disable. Returns 1 if successful, 0 otherwise */
+uint8_t spi_transfer_seq(SPIState *spi, const SPIMessage *msgs, uint8_t count);
 void spi_close(SPIState *spi);
 
 #endif	/* SPI_H */
\ No newline at end of file
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include "spscring.h"
+
+#define CACHE_LINE 64
+
+typedef struct spsc_ring {
+  /* Producer's line */
+  _Alignas(CACHE_LINE) atomic_uint head;
+  unsigned int tail_cache; /* Last tail seen, saves touching the consumer's line */
+  /* Consumer's line */
+  _Alignas(CACHE_LINE) atomic_uint tail;
+  unsigned int head_cache;
+  atomic_int parked; /* Consumer is (about to be) asleep on the eventfd */
+  /* Read-only after creation */
+  _Alignas(CACHE_LINE) unsigned int size;
+  unsigned int mask;
+  int efd;
+  _Atomic(void *) *elements;
+} SPSCRing;
+
+SPSCRing *spsc_create(int size) {
+  unsigned int capacity = 1;
+  SPSCRing *r;
+  if (size <= 0) return NULL;
+  if (posix_memalign((void **)&r, CACHE_LINE, sizeof(SPSCRing))) return NULL;
+  while (capacity < (unsigned int)size) capacity <<= 1;
+  r->size = size;
+  r->mask = capacity - 1;
+  r->elements = (_Atomic(void *) *)malloc(capacity * sizeof(*r->elements));
+  r->efd = eventfd(0, EFD_CLOEXEC);
+  if (r->elements == NULL || r->efd < 0) {
+    free(r->elements);
+    if (r->efd >= 0) close(r->efd);
+    free(r);
+    return NULL;
+  }
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+  atomic_init(&r->parked, 0);
+  r->tail_cache = 0;
+  r->head_cache = 0;
+  return r;
+}
+
+int spsc_add(SPSCRing *r, void *element) {
+  uint64_t one = 1;
+  unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  if (head - r->tail_cache == r->size) {
+    r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head - r->tail_cache == r->size) return 0;
+  }
+  atomic_store_explicit(&r->elements[head & r->mask], element, memory_order_relaxed);
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&r->parked, memory_order_relaxed) &&
+      atomic_exchange(&r->parked, 0)) {
+    if (write(r->efd, &one, sizeof(one)) < 0) return 1; /* Consumer retries on wake */
+  }
+  return 1;
+}
+
+/* The tail is advanced with a compare-exchange rather than a store so that
+ * spsc_evict() can take the oldest element from the producer side. A take
+ * that loses to an eviction simply retries with the new tail */
+static int ring_take(SPSCRing *r, void **elements, unsigned int max) {
+  unsigned int tail = atomic_load_explicit(&r->tail, memory_order_acquire), i, n;
+  do {
+    if ((int)(r->head_cache - tail) <= 0) {
+      r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+      if ((int)(r->head_cache - tail) <= 0) return 0;
+    }
+    n = r->head_cache - tail;
+    if (n > max) n = max;
+    for (i = 0; i < n; i++)
+      elements[i] = atomic_load_explicit(&r->elements[(tail + i) & r->mask], memory_order_relaxed);
+  } while (!atomic_compare_exchange_weak_explicit(&r->tail, &tail, tail + n,
+                                                  memory_order_release, memory_order_acquire));
+  return n;
+}
+
+int spsc_remove_batch(SPSCRing *r, void **elements, int max, int blocking) {
+  uint64_t val;
+  int n;
+  if (max <= 0) return 0;
+  for (;;) {
+    if ((n = ring_take(r, elements, max)) > 0 || !blocking) return n;
+    atomic_store_explicit(&r->parked, 1, memory_order_relaxed);
+    /* Pairs with the fence in spsc_add, one side always sees the other */
+    atomic_thread_fence(memory_order_seq_cst);
+    n = ring_take(r, elements, max); /* The producer may have added before seeing us park */
+    if (n == 0 && read(r->efd, &val, sizeof(val)) < 0) continue;
+    atomic_store_explicit(&r->parked, 0, memory_order_relaxed);
+    if (n) return n;
+  }
+}
+
+void *spsc_remove(SPSCRing *r, int blocking) {
+  void *element;
+  return (spsc_remove_batch(r, &element, 1, blocking) ? element : NULL);
+}
+
+void *spsc_evict(SPSCRing *r) {
+  void *element;
+  unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  do {
+    if (tail == head) return NULL; /* The consumer emptied it first */
+    element = atomic_load_explicit(&r->elements[tail & r->mask], memory_order_relaxed);
+  } while (!atomic_compare_exchange_weak_explicit(&r->tail, &tail, tail + 1,
+                                                  memory_order_acq_rel, memory_order_acquire));
+  r->tail_cache = tail + 1;
+  return element;
+}
+
+int spsc_count(SPSCRing *r) {
+  unsigned int tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  return atomic_load_explicit(&r->head, memory_order_acquire) - tail;
+}
+
+int spsc_size(SPSCRing *r) {
+  return r->size;
+}
+
+void spsc_destroy(SPSCRing *r) {
+  close(r->efd);
+  free(r->elements);
+  free(r);
+}
@@ -0,0 +1,20 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+/* Lock-free ring for exactly one producer thread and one consumer thread.
+ * The consumer only makes a syscall when it has to park on an empty ring,
+ * and the producer only when the consumer is parked */
+typedef struct spsc_ring SPSCRing;
+
+SPSCRing *spsc_create(int size);
+int spsc_add(SPSCRing *r, void *element); /* Producer only, never blocks */
+void *spsc_remove(SPSCRing *r, int blocking); /* Consumer only */
+/* Consumer only, takes up to max elements at once, blocking only for the first */
+int spsc_remove_batch(SPSCRing *r, void **elements, int max, int blocking);
+/* Producer only, takes the oldest element back out to make room */
+void *spsc_evict(SPSCRing *r);
+int spsc_count(SPSCRing *r);
+int spsc_size(SPSCRing *r);
+void spsc_destroy(SPSCRing *r);
+
+#endif /* SPSCRING_H */